@@ -3,6 +3,12 @@
  * (C) Copyright David Gibson <dwg@au1.ibm.com>, IBM Corporation.  2007.
  */
 
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+
+#include <time.h>
+
 #include "dtc.h"
 #include "srcpos.h"
 
@@ -26,20 +32,34 @@ enum checkstatus {
 
 struct check;
 
+/* What --check-stats reports for each check */
+struct check_stats {
+	double time;		/* in the check's own callbacks, seconds */
+	double prereq_time;	/* getting its prerequisites run */
+	unsigned long nodes, props, failures;
+};
+
 typedef void (*check_fn)(struct check *c, struct dt_info *dti, struct node *node);
+typedef void (*check_prop_fn)(struct check *c, struct dt_info *dti,
+			      struct node *node, struct property *prop);
 
 struct check {
 	const char *name;
 	check_fn fn;
+	check_prop_fn prop_fn;
+	const char * const *props;
 	void *data;
 	bool warn, error;
+	bool fixup;
 	enum checkstatus status;
-	bool inprogress;
+	bool inprogress, queued;
+	char *output;
+	struct check_stats stats;
 	int num_prereqs;
 	struct check **prereq;
 };
 
-#define CHECK_ENTRY(nm_, fn_, d_, w_, e_, ...)	       \
+#define CHECK_ENTRY(nm_, fn_, d_, w_, e_, f_, ...)	       \
 	static struct check *nm_##_prereqs[] = { __VA_ARGS__ }; \
 	static struct check nm_ = { \
 		.name = #nm_, \
@@ -47,16 +67,94 @@ struct check {
 		.data = (d_), \
 		.warn = (w_), \
 		.error = (e_), \
+		.fixup = (f_), \
 		.status = UNCHECKED, \
 		.num_prereqs = ARRAY_SIZE(nm_##_prereqs), \
 		.prereq = nm_##_prereqs, \
 	};
 #define WARNING(nm_, fn_, d_, ...) \
-	CHECK_ENTRY(nm_, fn_, d_, true, false, __VA_ARGS__)
+	CHECK_ENTRY(nm_, fn_, d_, true, false, false, __VA_ARGS__)
 #define ERROR(nm_, fn_, d_, ...) \
-	CHECK_ENTRY(nm_, fn_, d_, false, true, __VA_ARGS__)
+	CHECK_ENTRY(nm_, fn_, d_, false, true, false, __VA_ARGS__)
 #define CHECK(nm_, fn_, d_, ...) \
-	CHECK_ENTRY(nm_, fn_, d_, false, false, __VA_ARGS__)
+	CHECK_ENTRY(nm_, fn_, d_, false, false, false, __VA_ARGS__)
+
+/*
+ * Checks which only look at some properties name them, as a list made
+ * with PROPS() of property names, or of suffixes such as "*-gpios", and
+ * are called for each property which matches one of them.
+ */
+#define PROP_CHECK_ENTRY(nm_, fn_, d_, p_, w_, e_, ...)	       \
+	static struct check *nm_##_prereqs[] = { __VA_ARGS__ }; \
+	static struct check nm_ = { \
+		.name = #nm_, \
+		.prop_fn = (fn_), \
+		.props = (p_), \
+		.data = (d_), \
+		.warn = (w_), \
+		.error = (e_), \
+		.status = UNCHECKED, \
+		.num_prereqs = ARRAY_SIZE(nm_##_prereqs), \
+		.prereq = nm_##_prereqs, \
+	};
+#define PROPS(...)	((const char * const []){ __VA_ARGS__, NULL })
+#define WARNING_PROP(nm_, fn_, d_, p_, ...) \
+	PROP_CHECK_ENTRY(nm_, fn_, d_, p_, true, false, __VA_ARGS__)
+#define ERROR_PROP(nm_, fn_, d_, p_, ...) \
+	PROP_CHECK_ENTRY(nm_, fn_, d_, p_, false, true, __VA_ARGS__)
+#define CHECK_PROP(nm_, fn_, d_, p_, ...) \
+	PROP_CHECK_ENTRY(nm_, fn_, d_, p_, false, false, __VA_ARGS__)
+
+/*
+ * Checks which change the tree, or node state other checks look at,
+ * get a traversal to themselves rather than sharing one.
+ */
+#define WARNING_FIXUP(nm_, fn_, d_, ...) \
+	CHECK_ENTRY(nm_, fn_, d_, true, false, true, __VA_ARGS__)
+#define ERROR_FIXUP(nm_, fn_, d_, ...) \
+	CHECK_ENTRY(nm_, fn_, d_, false, true, true, __VA_ARGS__)
+
+/*
+ * With more than one job, the queued checks (see below) are run on
+ * parts of the tree in parallel.  Each part is a work item collecting
+ * the failures and messages of the checks run on it, which are replayed
+ * check by check, and item by item in tree order, once all are done.
+ */
+struct check_record {
+	struct check *check;
+	bool failed;
+	char *msg;
+};
+
+struct check_item {
+	struct node *node;
+	bool subtree;		/* or just the node itself */
+	struct check_record *records;
+	unsigned int count, size;
+};
+
+#ifdef NO_THREADS
+static struct check_item *check_item;
+#else
+static __thread struct check_item *check_item;
+#endif
+
+static void check_item_add(struct check_item *item, struct check *c,
+			   bool failed, char *msg)
+{
+	struct check_record *r;
+
+	if (item->count == item->size) {
+		item->size = item->size ? item->size * 2 : 4;
+		item->records = xrealloc(item->records,
+					 item->size * sizeof(*item->records));
+	}
+
+	r = &item->records[item->count++];
+	r->check = c;
+	r->failed = failed;
+	r->msg = msg;
+}
 
 static inline void  PRINTF(5, 6) check_msg(struct check *c, struct dt_info *dti,
 					   struct node *node,
@@ -113,36 +211,393 @@ static inline void  PRINTF(5, 6) check_msg(struct check *c, struct dt_info *dti,
 		}
 	}
 
+	if (check_item) {
+		check_item_add(check_item, c, false, str);
+		return;
+	}
+
+	if (c->queued) {
+		xasprintf_append(&c->output, "%s", str);
+		free(str);
+		return;
+	}
+
 	fputs(str, stderr);
+	free(str);
+}
+
+static void check_failed(struct check *c)
+{
+	if (check_item) {
+		check_item_add(check_item, c, true, NULL);
+	} else {
+		c->status = FAILED;
+		c->stats.failures++;
+	}
 }
 
 #define FAIL(c, dti, node, ...)						\
 	do {								\
 		TRACE((c), "\t\tFAILED at %s:%d", __FILE__, __LINE__);	\
-		(c)->status = FAILED;					\
+		check_failed(c);					\
 		check_msg((c), dti, node, NULL, __VA_ARGS__);		\
 	} while (0)
 
 #define FAIL_PROP(c, dti, node, prop, ...)				\
 	do {								\
 		TRACE((c), "\t\tFAILED at %s:%d", __FILE__, __LINE__);	\
-		(c)->status = FAILED;					\
+		check_failed(c);					\
 		check_msg((c), dti, node, prop, __VA_ARGS__);		\
 	} while (0)
 
 
+static double check_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make a call on behalf of a check, timing and counting it for --check-stats */
+#define CHECK_CALL(c, counter, call)				\
+	do {							\
+		if (check_stats) {				\
+			double t_ = check_clock();		\
+			call;					\
+			(c)->stats.time += check_clock() - t_;	\
+			(c)->stats.counter++;			\
+		} else {					\
+			call;					\
+		}						\
+	} while (0)
+
 static void check_nodes_props(struct check *c, struct dt_info *dti, struct node *node)
 {
 	struct node *child;
 
 	TRACE(c, "%s", node->fullpath);
 	if (c->fn)
-		c->fn(c, dti, node);
+		CHECK_CALL(c, nodes, c->fn(c, dti, node));
 
 	for_each_child(node, child)
 		check_nodes_props(c, dti, child);
 }
 
+/*
+ * Checks which neither change the tree nor can fail with an error are
+ * queued up rather than run straight away, and run together in a
+ * single traversal once something needs their result, holding their
+ * messages back so that they come out in the usual order.
+ */
+static struct check **check_queue;
+static unsigned int check_queue_len, check_queue_size;
+
+/*
+ * The property names and suffixes the queued property checks ask for,
+ * hashed so that each property of the tree is only looked up, rather
+ * than offered to every check.
+ */
+struct prop_dispatch_entry {
+	const char *name;	/* suffixes without their '*' */
+	bool suffix;
+	struct check *check;
+};
+
+static struct prop_dispatch_entry *prop_dispatch;
+static unsigned int prop_dispatch_size;
+
+static unsigned int prop_dispatch_hash(const char *name)
+{
+	return str_hash(name, strlen(name)) & (prop_dispatch_size - 1);
+}
+
+static void build_prop_dispatch(void)
+{
+	unsigned int i, j, count = 0, h;
+
+	for (i = 0; i < check_queue_len; i++)
+		for (j = 0; check_queue[i]->props && check_queue[i]->props[j]; j++)
+			count++;
+
+	prop_dispatch_size = 0;
+	if (!count)
+		return;
+
+	prop_dispatch_size = 16;
+	while (prop_dispatch_size < 2 * count)
+		prop_dispatch_size *= 2;
+	prop_dispatch = xmalloc(prop_dispatch_size * sizeof(*prop_dispatch));
+	memset(prop_dispatch, 0, prop_dispatch_size * sizeof(*prop_dispatch));
+
+	for (i = 0; i < check_queue_len; i++) {
+		struct check *c = check_queue[i];
+
+		for (j = 0; c->props && c->props[j]; j++) {
+			const char *name = c->props[j];
+			bool suffix = name[0] == '*';
+
+			if (suffix)
+				name++;
+			h = prop_dispatch_hash(name);
+			while (prop_dispatch[h].name)
+				h = (h + 1) & (prop_dispatch_size - 1);
+			prop_dispatch[h].name = name;
+			prop_dispatch[h].suffix = suffix;
+			prop_dispatch[h].check = c;
+		}
+	}
+}
+
+static void free_prop_dispatch(void)
+{
+	free(prop_dispatch);
+	prop_dispatch = NULL;
+	prop_dispatch_size = 0;
+}
+
+static void dispatch_prop(struct dt_info *dti, struct node *node,
+			  struct property *prop, const char *name, bool suffix)
+{
+	unsigned int h = prop_dispatch_hash(name);
+	struct prop_dispatch_entry *e;
+
+	for (e = &prop_dispatch[h]; e->name;
+	     h = (h + 1) & (prop_dispatch_size - 1), e = &prop_dispatch[h]) {
+		if (e->suffix != suffix || !streq(e->name, name))
+			continue;
+
+		TRACE(e->check, "%s:%s", node->fullpath, prop->name);
+		CHECK_CALL(e->check, props,
+			   e->check->prop_fn(e->check, dti, node, prop));
+	}
+}
+
+static void check_queued_node(struct dt_info *dti, struct node *node)
+{
+	struct property *prop;
+	const char *p;
+	unsigned int i;
+
+	for (i = 0; i < check_queue_len; i++) {
+		struct check *c = check_queue[i];
+
+		TRACE(c, "%s", node->fullpath);
+		if (c->fn)
+			CHECK_CALL(c, nodes, c->fn(c, dti, node));
+	}
+
+	if (!prop_dispatch_size)
+		return;
+
+	for_each_property(node, prop) {
+		dispatch_prop(dti, node, prop, prop->name, false);
+		for (p = strchr(prop->name, '-'); p; p = strchr(p + 1, '-'))
+			dispatch_prop(dti, node, prop, p, true);
+	}
+}
+
+static void check_queued_nodes_props(struct dt_info *dti, struct node *node)
+{
+	struct node *child;
+
+	check_queued_node(dti, node);
+
+	for_each_child(node, child)
+		check_queued_nodes_props(dti, child);
+}
+
+#ifndef NO_THREADS
+struct check_pool {
+	struct dt_info *dti;
+	struct check_item *items;
+	unsigned int count, next;
+	pthread_mutex_t lock;
+};
+
+static void *check_worker(void *arg)
+{
+	struct check_pool *pool = arg;
+	struct check_item *item;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		item = pool->next < pool->count ? &pool->items[pool->next++] : NULL;
+		pthread_mutex_unlock(&pool->lock);
+		if (!item)
+			break;
+
+		check_item = item;
+		if (item->subtree)
+			check_queued_nodes_props(pool->dti, item->node);
+		else
+			check_queued_node(pool->dti, item->node);
+		check_item = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * Split the tree into at least a few items per job, by replacing
+ * subtrees with their top node and its child subtrees a level at a
+ * time.  The items stay in tree order.
+ */
+static struct check_item *split_check_items(struct node *dt, unsigned int *count)
+{
+	struct check_item *items, *next;
+	unsigned int n = 1, subtrees = 1, i, j;
+	struct node *child;
+	bool split = true;
+
+	items = xmalloc(sizeof(*items));
+	memset(items, 0, sizeof(*items));
+	items[0].node = dt;
+	items[0].subtree = true;
+
+	while (split && subtrees < 4 * (unsigned int)jobs) {
+		unsigned int m = n;
+
+		for (i = 0; i < n; i++)
+			if (items[i].subtree)
+				for_each_child(items[i].node, child)
+					m++;
+
+		next = xmalloc(m * sizeof(*next));
+		memset(next, 0, m * sizeof(*next));
+		split = false;
+		subtrees = 0;
+
+		for (i = 0, j = 0; i < n; i++) {
+			next[j] = items[i];
+			if (!items[i].subtree || !items[i].node->children) {
+				subtrees += items[i].subtree;
+				j++;
+				continue;
+			}
+
+			next[j++].subtree = false;
+			for_each_child(items[i].node, child) {
+				next[j].node = child;
+				next[j++].subtree = true;
+				subtrees++;
+				split = true;
+			}
+		}
+
+		free(items);
+		items = next;
+		n = j;
+	}
+
+	*count = n;
+	return items;
+}
+
+static void run_queued_checks_parallel(struct dt_info *dti)
+{
+	struct check_pool pool;
+	pthread_t *threads;
+	unsigned int nthreads = 0, i, j, k;
+
+	/* Lookups must not build their indexes behind each other's backs */
+	index_tree(dti->dt);
+
+	memset(&pool, 0, sizeof(pool));
+	pool.dti = dti;
+	pool.items = split_check_items(dti->dt, &pool.count);
+	pthread_mutex_init(&pool.lock, NULL);
+
+	threads = xmalloc((jobs - 1) * sizeof(*threads));
+	for (i = 0; i < (unsigned int)jobs - 1; i++)
+		if (pthread_create(&threads[nthreads], NULL, check_worker,
+				   &pool) == 0)
+			nthreads++;
+
+	check_worker(&pool);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&pool.lock);
+
+	for (i = 0; i < check_queue_len; i++) {
+		struct check *c = check_queue[i];
+
+		for (j = 0; j < pool.count; j++) {
+			struct check_item *item = &pool.items[j];
+
+			for (k = 0; k < item->count; k++) {
+				struct check_record *r = &item->records[k];
+
+				if (r->check != c)
+					continue;
+				if (r->failed) {
+					c->status = FAILED;
+					c->stats.failures++;
+				}
+				if (r->msg) {
+					xasprintf_append(&c->output, "%s", r->msg);
+					free(r->msg);
+				}
+			}
+		}
+	}
+
+	for (j = 0; j < pool.count; j++)
+		free(pool.items[j].records);
+	free(pool.items);
+}
+#endif
+
+static void run_queued_checks(struct dt_info *dti)
+{
+	unsigned int i;
+
+	if (!check_queue_len)
+		return;
+
+	build_prop_dispatch();
+#ifndef NO_THREADS
+	/* Timings are taken on a single thread */
+	if (jobs > 1 && !check_stats)
+		run_queued_checks_parallel(dti);
+	else
+#endif
+		check_queued_nodes_props(dti, dti->dt);
+	free_prop_dispatch();
+
+	for (i = 0; i < check_queue_len; i++) {
+		struct check *c = check_queue[i];
+
+		c->queued = false;
+		if (c->output) {
+			fputs(c->output, stderr);
+			free(c->output);
+			c->output = NULL;
+		}
+
+		if (c->status == UNCHECKED)
+			c->status = PASSED;
+
+		TRACE(c, "\tCompleted, status %d", c->status);
+	}
+
+	check_queue_len = 0;
+}
+
+static void queue_check(struct check *c)
+{
+	if (check_queue_len == check_queue_size) {
+		check_queue_size = check_queue_size ? check_queue_size * 2 : 32;
+		check_queue = xrealloc(check_queue,
+				       check_queue_size * sizeof(*check_queue));
+	}
+
+	c->queued = true;
+	check_queue[check_queue_len++] = c;
+}
+
 static bool is_multiple_of(int multiple, int divisor)
 {
 	if (divisor == 0)
@@ -155,28 +610,47 @@ static bool run_check(struct check *c, struct dt_info *dti)
 {
 	struct node *dt = dti->dt;
 	bool error = false;
+	double start = 0;
 	int i;
 
 	assert(!c->inprogress);
 
-	if (c->status != UNCHECKED)
+	if (c->status != UNCHECKED || c->queued)
 		goto out;
 
 	c->inprogress = true;
 
+	if (check_stats)
+		start = check_clock();
+
 	for (i = 0; i < c->num_prereqs; i++) {
 		struct check *prq = c->prereq[i];
 		error = error || run_check(prq, dti);
+		if (prq->queued)
+			run_queued_checks(dti);
 		if (prq->status != PASSED) {
+			run_queued_checks(dti);
 			c->status = PREREQ;
 			check_msg(c, dti, NULL, NULL, "Failed prerequisite '%s'",
 				  c->prereq[i]->name);
 		}
 	}
 
+	if (check_stats)
+		c->stats.prereq_time += check_clock() - start;
+
 	if (c->status != UNCHECKED)
 		goto out;
 
+	if (!c->fixup) {
+		/* Errors are needed straight away, to decide what runs next */
+		queue_check(c);
+		if (c->error)
+			run_queued_checks(dti);
+		goto out;
+	}
+
+	run_queued_checks(dti);
 	check_nodes_props(c, dti, dt);
 
 	if (c->status == UNCHECKED)
@@ -204,35 +678,22 @@ static inline void check_always_fail(struct check *c, struct dt_info *dti,
 CHECK(always_fail, check_always_fail, NULL);
 
 static void check_is_string(struct check *c, struct dt_info *dti,
-			    struct node *node)
+			    struct node *node, struct property *prop)
 {
-	struct property *prop;
-	char *propname = c->data;
-
-	prop = get_property(node, propname);
-	if (!prop)
-		return; /* Not present, assumed ok */
-
 	if (!data_is_one_string(prop->val))
 		FAIL_PROP(c, dti, node, prop, "property is not a string");
 }
 #define WARNING_IF_NOT_STRING(nm, propname) \
-	WARNING(nm, check_is_string, (propname))
+	WARNING_PROP(nm, check_is_string, NULL, PROPS(propname))
 #define ERROR_IF_NOT_STRING(nm, propname) \
-	ERROR(nm, check_is_string, (propname))
+	ERROR_PROP(nm, check_is_string, NULL, PROPS(propname))
 
 static void check_is_string_list(struct check *c, struct dt_info *dti,
-				 struct node *node)
+				 struct node *node, struct property *prop)
 {
 	int rem, l;
-	struct property *prop;
-	char *propname = c->data;
 	char *str;
 
-	prop = get_property(node, propname);
-	if (!prop)
-		return; /* Not present, assumed ok */
-
 	str = prop->val.val;
 	rem = prop->val.len;
 	while (rem > 0) {
@@ -246,59 +707,136 @@ static void check_is_string_list(struct check *c, struct dt_info *dti,
 	}
 }
 #define WARNING_IF_NOT_STRING_LIST(nm, propname) \
-	WARNING(nm, check_is_string_list, (propname))
+	WARNING_PROP(nm, check_is_string_list, NULL, PROPS(propname))
 #define ERROR_IF_NOT_STRING_LIST(nm, propname) \
-	ERROR(nm, check_is_string_list, (propname))
+	ERROR_PROP(nm, check_is_string_list, NULL, PROPS(propname))
 
 static void check_is_cell(struct check *c, struct dt_info *dti,
-			  struct node *node)
+			  struct node *node, struct property *prop)
 {
-	struct property *prop;
-	char *propname = c->data;
-
-	prop = get_property(node, propname);
-	if (!prop)
-		return; /* Not present, assumed ok */
-
 	if (prop->val.len != sizeof(cell_t))
 		FAIL_PROP(c, dti, node, prop, "property is not a single cell");
 }
 #define WARNING_IF_NOT_CELL(nm, propname) \
-	WARNING(nm, check_is_cell, (propname))
+	WARNING_PROP(nm, check_is_cell, NULL, PROPS(propname))
 #define ERROR_IF_NOT_CELL(nm, propname) \
-	ERROR(nm, check_is_cell, (propname))
+	ERROR_PROP(nm, check_is_cell, NULL, PROPS(propname))
 
 /*
  * Structural check functions
  */
 
+/*
+ * Chain together the entries of keys[] with equal strings, in order:
+ * next[i] is the entry after i with the same key, or n if there is
+ * none, and first[i] the first entry with that key.  NULL keys are
+ * left out.  This lets the duplicate checks below visit each pair of
+ * equal entries without comparing every pair of entries.
+ */
+static void link_equal_keys(const char **keys, unsigned int n,
+			    unsigned int *first, unsigned int *next)
+{
+	unsigned int size = 16, i, h, *slots, *last;
+
+	while (size < 2 * n)
+		size *= 2;
+	slots = xmalloc(size * sizeof(*slots));
+	memset(slots, 0, size * sizeof(*slots));
+	last = xmalloc(n * sizeof(*last));
+
+	for (i = 0; i < n; i++) {
+		next[i] = n;
+		if (!keys[i])
+			continue;
+
+		h = str_hash(keys[i], strlen(keys[i])) & (size - 1);
+		while (slots[h] && !streq(keys[slots[h] - 1], keys[i]))
+			h = (h + 1) & (size - 1);
+
+		if (!slots[h]) {
+			slots[h] = i + 1;
+			first[i] = last[i] = i;
+		} else {
+			first[i] = slots[h] - 1;
+			next[last[first[i]]] = i;
+			last[first[i]] = i;
+		}
+	}
+
+	free(slots);
+	free(last);
+}
+
 static void check_duplicate_node_names(struct check *c, struct dt_info *dti,
 				       struct node *node)
 {
-	struct node *child, *child2;
+	struct node *child, **children;
+	const char **names;
+	unsigned int n = 0, i, j, *first, *next;
 
-	for_each_child(node, child)
-		for (child2 = child->next_sibling;
-		     child2;
-		     child2 = child2->next_sibling)
-			if (streq(child->name, child2->name))
-				FAIL(c, dti, child2, "Duplicate node name");
+	for_each_child_withdel(node, child)
+		n++;
+	if (n < 2)
+		return;
+
+	children = xmalloc(n * sizeof(*children));
+	names = xmalloc(n * sizeof(*names));
+	first = xmalloc(n * sizeof(*first));
+	next = xmalloc(n * sizeof(*next));
+
+	n = 0;
+	for_each_child_withdel(node, child) {
+		children[n] = child;
+		names[n++] = child->name;
+	}
+	link_equal_keys(names, n, first, next);
+
+	for (i = 0; i < n; i++) {
+		if (children[i]->deleted)
+			continue;
+		for (j = next[i]; j < n; j = next[j])
+			FAIL(c, dti, children[j], "Duplicate node name");
+	}
+
+	free(children);
+	free(names);
+	free(first);
+	free(next);
 }
 ERROR(duplicate_node_names, check_duplicate_node_names, NULL);
 
 static void check_duplicate_property_names(struct check *c, struct dt_info *dti,
 					   struct node *node)
 {
-	struct property *prop, *prop2;
+	struct property *prop, **props;
+	const char **names;
+	unsigned int n = 0, i, j, *first, *next;
 
-	for_each_property(node, prop) {
-		for (prop2 = prop->next; prop2; prop2 = prop2->next) {
-			if (prop2->deleted)
-				continue;
-			if (streq(prop->name, prop2->name))
-				FAIL_PROP(c, dti, node, prop, "Duplicate property name");
-		}
+	for_each_property_withdel(node, prop)
+		n++;
+	if (n < 2)
+		return;
+
+	props = xmalloc(n * sizeof(*props));
+	names = xmalloc(n * sizeof(*names));
+	first = xmalloc(n * sizeof(*first));
+	next = xmalloc(n * sizeof(*next));
+
+	n = 0;
+	for_each_property_withdel(node, prop) {
+		props[n] = prop;
+		names[n++] = prop->deleted ? NULL : prop->name;
 	}
+	link_equal_keys(names, n, first, next);
+
+	for (i = 0; i < n; i++)
+		for (j = next[i]; j < n; j = next[j])
+			FAIL_PROP(c, dti, node, props[i], "Duplicate property name");
+
+	free(props);
+	free(names);
+	free(first);
+	free(next);
 }
 ERROR(duplicate_property_names, check_duplicate_property_names, NULL);
 
@@ -561,20 +1099,14 @@ static void check_explicit_phandles(struct check *c, struct dt_info *dti,
 		return;
 	}
 
-	node->phandle = phandle;
+	set_node_phandle(root, node, phandle);
 }
-ERROR(explicit_phandles, check_explicit_phandles, NULL);
+ERROR_FIXUP(explicit_phandles, check_explicit_phandles, NULL);
 
 static void check_name_properties(struct check *c, struct dt_info *dti,
 				  struct node *node)
 {
-	struct property **pp, *prop = NULL;
-
-	for (pp = &node->proplist; *pp; pp = &((*pp)->next))
-		if (streq((*pp)->name, "name")) {
-			prop = *pp;
-			break;
-		}
+	struct property *prop = get_property(node, "name");
 
 	if (!prop)
 		return; /* No name property, that's fine */
@@ -586,14 +1118,11 @@ static void check_name_properties(struct check *c, struct dt_info *dti,
 	} else {
 		/* The name property is correct, and therefore redundant.
 		 * Delete it */
-		*pp = prop->next;
-		free(prop->name);
-		data_free(prop->val);
-		free(prop);
+		delete_property(node, prop);
 	}
 }
 ERROR_IF_NOT_STRING(name_is_string, "name");
-ERROR(name_properties, check_name_properties, NULL, &name_is_string);
+ERROR_FIXUP(name_properties, check_name_properties, NULL, &name_is_string);
 
 /*
  * Reference fixup functions
@@ -631,39 +1160,53 @@ static void fixup_phandle_references(struct check *c, struct dt_info *dti,
 		}
 	}
 }
-ERROR(phandle_references, fixup_phandle_references, NULL,
+ERROR_FIXUP(phandle_references, fixup_phandle_references, NULL,
       &duplicate_node_names, &explicit_phandles);
 
-static void fixup_path_references(struct check *c, struct dt_info *dti,
-				  struct node *node)
-{
-	struct node *dt = dti->dt;
+struct path_ref_ctx {
+	struct check *c;
+	struct dt_info *dti;
+	struct node *node;
 	struct property *prop;
+};
 
-	for_each_property(node, prop) {
-		struct marker *m = prop->val.markers;
-		struct node *refnode;
-		char *path;
+static const void *resolve_path_reference(struct marker *m, int *len,
+					  void *arg)
+{
+	struct path_ref_ctx *ctx = arg;
+	struct check *c = ctx->c;
+	struct dt_info *dti = ctx->dti;
+	struct node *refnode;
 
-		for_each_marker_of_type(m, REF_PATH) {
-			assert(m->offset <= prop->val.len);
+	assert(m->offset <= ctx->prop->val.len);
 
-			refnode = get_node_by_ref(dt, m->ref);
-			if (!refnode) {
-				FAIL(c, dti, node, "Reference to non-existent node or label \"%s\"\n",
-				     m->ref);
-				continue;
-			}
+	refnode = get_node_by_ref(dti->dt, m->ref);
+	if (!refnode) {
+		FAIL(c, dti, ctx->node, "Reference to non-existent node or label \"%s\"\n",
+		     m->ref);
+		return NULL;
+	}
 
-			path = refnode->fullpath;
-			prop->val = data_insert_at_marker(prop->val, m, path,
-							  strlen(path) + 1);
+	reference_node(refnode);
 
-			reference_node(refnode);
-		}
+	*len = strlen(refnode->fullpath) + 1;
+	return refnode->fullpath;
+}
+
+static void fixup_path_references(struct check *c, struct dt_info *dti,
+				  struct node *node)
+{
+	struct path_ref_ctx ctx = { c, dti, node, NULL };
+	struct property *prop;
+
+	for_each_property(node, prop) {
+		ctx.prop = prop;
+		prop->val = data_insert_at_markers(prop->val, REF_PATH,
+						   resolve_path_reference,
+						   &ctx);
 	}
 }
-ERROR(path_references, fixup_path_references, NULL, &duplicate_node_names);
+ERROR_FIXUP(path_references, fixup_path_references, NULL, &duplicate_node_names);
 
 static void fixup_omit_unused_nodes(struct check *c, struct dt_info *dti,
 				    struct node *node)
@@ -673,7 +1216,7 @@ static void fixup_omit_unused_nodes(struct check *c, struct dt_info *dti,
 	if (node->omit_if_unused && !node->is_referenced)
 		delete_node(node);
 }
-ERROR(omit_unused_nodes, fixup_omit_unused_nodes, NULL, &phandle_references, &path_references);
+ERROR_FIXUP(omit_unused_nodes, fixup_omit_unused_nodes, NULL, &phandle_references, &path_references);
 
 /*
  * Semantic checks
@@ -688,20 +1231,7 @@ WARNING_IF_NOT_STRING(label_is_string, "label");
 
 WARNING_IF_NOT_STRING_LIST(compatible_is_string_list, "compatible");
 
-static void check_names_is_string_list(struct check *c, struct dt_info *dti,
-				       struct node *node)
-{
-	struct property *prop;
-
-	for_each_property(node, prop) {
-		if (!strends(prop->name, "-names"))
-			continue;
-
-		c->data = prop->name;
-		check_is_string_list(c, dti, node);
-	}
-}
-WARNING(names_is_string_list, check_names_is_string_list, NULL);
+WARNING_PROP(names_is_string_list, check_is_string_list, NULL, PROPS("*-names"));
 
 static void check_alias_paths(struct check *c, struct dt_info *dti,
 				    struct node *node)
@@ -744,7 +1274,7 @@ static void fixup_addr_size_cells(struct check *c, struct dt_info *dti,
 	if (prop)
 		node->size_cells = propval_cell(prop);
 }
-WARNING(addr_size_cells, fixup_addr_size_cells, NULL,
+WARNING_FIXUP(addr_size_cells, fixup_addr_size_cells, NULL,
 	&address_cells_is_cell, &size_cells_is_cell);
 
 #define node_addr_cells(n) \
@@ -867,7 +1397,7 @@ static void check_pci_bridge(struct check *c, struct dt_info *dti, struct node *
 	if (fdt32_to_cpu(cells[1]) > 0xff)
 		FAIL_PROP(c, dti, node, prop, "maximum bus number must be less than 256");
 }
-WARNING(pci_bridge, check_pci_bridge, NULL,
+WARNING_FIXUP(pci_bridge, check_pci_bridge, NULL,
 	&device_type_is_string, &addr_size_cells);
 
 static void check_pci_device_bus_num(struct check *c, struct dt_info *dti, struct node *node)
@@ -969,7 +1499,7 @@ static void check_simple_bus_bridge(struct check *c, struct dt_info *dti, struct
 	if (node_is_compatible(node, "simple-bus"))
 		node->bus = &simple_bus;
 }
-WARNING(simple_bus_bridge, check_simple_bus_bridge, NULL,
+WARNING_FIXUP(simple_bus_bridge, check_simple_bus_bridge, NULL,
 	&addr_size_cells, &compatible_is_string_list);
 
 static void check_simple_bus_reg(struct check *c, struct dt_info *dti, struct node *node)
@@ -1039,7 +1569,7 @@ static void check_i2c_bus_bridge(struct check *c, struct dt_info *dti, struct no
 		FAIL(c, dti, node, "incorrect #size-cells for I2C bus");
 
 }
-WARNING(i2c_bus_bridge, check_i2c_bus_bridge, NULL, &addr_size_cells);
+WARNING_FIXUP(i2c_bus_bridge, check_i2c_bus_bridge, NULL, &addr_size_cells);
 
 #define I2C_OWN_SLAVE_ADDRESS	(1U << 30)
 #define I2C_TEN_BIT_ADDRESS	(1U << 31)
@@ -1131,7 +1661,7 @@ static void check_spi_bus_bridge(struct check *c, struct dt_info *dti, struct no
 		FAIL(c, dti, node, "incorrect #size-cells for SPI bus");
 
 }
-WARNING(spi_bus_bridge, check_spi_bus_bridge, NULL, &addr_size_cells);
+WARNING_FIXUP(spi_bus_bridge, check_spi_bus_bridge, NULL, &addr_size_cells);
 
 static void check_spi_bus_reg(struct check *c, struct dt_info *dti, struct node *node)
 {
@@ -1255,7 +1785,9 @@ static void check_unique_unit_address_common(struct check *c,
 						struct node *node,
 						bool disable_check)
 {
-	struct node *childa;
+	struct node *child, **children;
+	const char **addrs;
+	unsigned int n = 0, a, b, *first, *next;
 
 	if (node->addr_cells < 0 || node->size_cells < 0)
 		return;
@@ -1263,28 +1795,39 @@ static void check_unique_unit_address_common(struct check *c,
 	if (!node->children)
 		return;
 
-	for_each_child(node, childa) {
-		struct node *childb;
-		const char *addr_a = get_unitname(childa);
-
-		if (!strlen(addr_a))
-			continue;
+	for_each_child(node, child)
+		n++;
+	if (n < 2)
+		return;
 
-		if (disable_check && node_is_disabled(childa))
-			continue;
+	children = xmalloc(n * sizeof(*children));
+	addrs = xmalloc(n * sizeof(*addrs));
+	first = xmalloc(n * sizeof(*first));
+	next = xmalloc(n * sizeof(*next));
 
-		for_each_child(node, childb) {
-			const char *addr_b = get_unitname(childb);
-			if (childa == childb)
-				break;
+	n = 0;
+	for_each_child(node, child) {
+		const char *addr = get_unitname(child);
 
-			if (disable_check && node_is_disabled(childb))
-				continue;
+		if (!strlen(addr)
+		    || (disable_check && node_is_disabled(child)))
+			addr = NULL;
+		children[n] = child;
+		addrs[n++] = addr;
+	}
+	link_equal_keys(addrs, n, first, next);
 
-			if (streq(addr_a, addr_b))
-				FAIL(c, dti, childb, "duplicate unit-address (also used in node %s)", childa->fullpath);
-		}
+	for (a = 0; a < n; a++) {
+		if (!addrs[a])
+			continue;
+		for (b = first[a]; b != a; b = next[b])
+			FAIL(c, dti, children[b], "duplicate unit-address (also used in node %s)", children[a]->fullpath);
 	}
+
+	free(children);
+	free(addrs);
+	free(first);
+	free(next);
 }
 
 static void check_unique_unit_address(struct check *c, struct dt_info *dti,
@@ -1300,7 +1843,7 @@ static void check_unique_unit_address_if_enabled(struct check *c, struct dt_info
 	check_unique_unit_address_common(c, dti, node, true);
 }
 CHECK_ENTRY(unique_unit_address_if_enabled, check_unique_unit_address_if_enabled,
-	    NULL, false, false, &avoid_default_addr_size);
+	    NULL, false, false, false, &avoid_default_addr_size);
 
 static void check_obsolete_chosen_interrupt_controller(struct check *c,
 						       struct dt_info *dti,
@@ -1349,8 +1892,7 @@ static void check_chosen_node_bootargs(struct check *c, struct dt_info *dti,
 	if (!prop)
 		return;
 
-	c->data = prop->name;
-	check_is_string(c, dti, node);
+	check_is_string(c, dti, node, prop);
 }
 WARNING(chosen_node_bootargs, check_chosen_node_bootargs, NULL);
 
@@ -1370,8 +1912,7 @@ static void check_chosen_node_stdout_path(struct check *c, struct dt_info *dti,
 		FAIL_PROP(c, dti, node, prop, "Use 'stdout-path' instead");
 	}
 
-	c->data = prop->name;
-	check_is_string(c, dti, node);
+	check_is_string(c, dti, node, prop);
 }
 WARNING(chosen_node_stdout_path, check_chosen_node_stdout_path, NULL);
 
@@ -1388,7 +1929,10 @@ static void check_property_phandle_args(struct check *c,
 					const struct provider *provider)
 {
 	struct node *root = dti->dt;
-	unsigned int cell, cellsize = 0;
+	struct node *provider_node = NULL;
+	struct marker *m = prop->val.markers;
+	unsigned int cell, cellsize = 0, provider_cells = 0;
+	cell_t provider_phandle = 0;
 
 	if (!is_multiple_of(prop->val.len, sizeof(cell_t))) {
 		FAIL_PROP(c, dti, node, prop,
@@ -1398,7 +1942,6 @@ static void check_property_phandle_args(struct check *c,
 	}
 
 	for (cell = 0; cell < prop->val.len / sizeof(cell_t); cell += cellsize + 1) {
-		struct node *provider_node;
 		struct property *cellprop;
 		cell_t phandle;
 		unsigned int expected;
@@ -1417,38 +1960,48 @@ static void check_property_phandle_args(struct check *c,
 			continue;
 		}
 
-		/* If we have markers, verify the current cell is a phandle */
+		/*
+		 * If we have markers, verify the current cell is a phandle.
+		 * Cells only move forward and markers are in offset order,
+		 * so the search carries on from where the last one ended.
+		 */
 		if (prop->val.markers) {
-			struct marker *m = prop->val.markers;
-			for_each_marker_of_type(m, REF_PHANDLE) {
-				if (m->offset == (cell * sizeof(cell_t)))
-					break;
-			}
-			if (!m)
+			while (m && ((m->type != REF_PHANDLE)
+				     || (m->offset < (cell * sizeof(cell_t)))))
+				m = m->next;
+			if (!m || (m->offset != (cell * sizeof(cell_t))))
 				FAIL_PROP(c, dti, node, prop,
 					  "cell %d is not a phandle reference",
 					  cell);
 		}
 
-		provider_node = get_node_by_phandle(root, phandle);
-		if (!provider_node) {
-			FAIL_PROP(c, dti, node, prop,
-				  "Could not get phandle node for (cell %d)",
-				  cell);
-			break;
-		}
-
-		cellprop = get_property(provider_node, provider->cell_name);
-		if (cellprop) {
-			cellsize = propval_cell(cellprop);
-		} else if (provider->optional) {
-			cellsize = 0;
+		/* Lists often name the same provider many times in a row */
+		if (provider_node && (phandle == provider_phandle)) {
+			cellsize = provider_cells;
 		} else {
-			FAIL(c, dti, node, "Missing property '%s' in node %s or bad phandle (referred from %s[%d])",
-			     provider->cell_name,
-			     provider_node->fullpath,
-			     prop->name, cell);
-			break;
+			provider_node = get_node_by_phandle(root, phandle);
+			if (!provider_node) {
+				FAIL_PROP(c, dti, node, prop,
+					  "Could not get phandle node for (cell %d)",
+					  cell);
+				break;
+			}
+
+			cellprop = get_property(provider_node, provider->cell_name);
+			if (cellprop) {
+				cellsize = propval_cell(cellprop);
+			} else if (provider->optional) {
+				cellsize = 0;
+			} else {
+				FAIL(c, dti, node, "Missing property '%s' in node %s or bad phandle (referred from %s[%d])",
+				     provider->cell_name,
+				     provider_node->fullpath,
+				     prop->name, cell);
+				break;
+			}
+
+			provider_phandle = phandle;
+			provider_cells = cellsize;
 		}
 
 		expected = (cell + cellsize + 1) * sizeof(cell_t);
@@ -1463,21 +2016,16 @@ static void check_property_phandle_args(struct check *c,
 
 static void check_provider_cells_property(struct check *c,
 					  struct dt_info *dti,
-				          struct node *node)
+				          struct node *node,
+					  struct property *prop)
 {
-	struct provider *provider = c->data;
-	struct property *prop;
-
-	prop = get_property(node, provider->prop_name);
-	if (!prop)
-		return;
-
-	check_property_phandle_args(c, dti, node, prop, provider);
+	check_property_phandle_args(c, dti, node, prop, c->data);
 }
 #define WARNING_PROPERTY_PHANDLE_CELLS(nm, propname, cells_name, ...) \
 	static struct provider nm##_provider = { (propname), (cells_name), __VA_ARGS__ }; \
 	WARNING_IF_NOT_CELL(nm##_is_cell, cells_name); \
-	WARNING(nm##_property, check_provider_cells_property, &nm##_provider, &nm##_is_cell, &phandle_references);
+	WARNING_PROP(nm##_property, check_provider_cells_property, &nm##_provider, \
+		     PROPS(propname), &nm##_is_cell, &phandle_references);
 
 WARNING_PROPERTY_PHANDLE_CELLS(clocks, "clocks", "#clock-cells");
 WARNING_PROPERTY_PHANDLE_CELLS(cooling_device, "cooling-device", "#cooling-cells");
@@ -1513,63 +2061,36 @@ static bool prop_is_gpio(struct property *prop)
 
 static void check_gpios_property(struct check *c,
 					  struct dt_info *dti,
-				          struct node *node)
+				          struct node *node,
+					  struct property *prop)
 {
-	struct property *prop;
+	struct provider provider;
 
 	/* Skip GPIO hog nodes which have 'gpios' property */
 	if (get_property(node, "gpio-hog"))
 		return;
 
-	for_each_property(node, prop) {
-		struct provider provider;
-
-		if (!prop_is_gpio(prop))
-			continue;
-
-		provider.prop_name = prop->name;
-		provider.cell_name = "#gpio-cells";
-		provider.optional = false;
-		check_property_phandle_args(c, dti, node, prop, &provider);
-	}
+	if (!prop_is_gpio(prop))
+		return;
 
+	provider.prop_name = prop->name;
+	provider.cell_name = "#gpio-cells";
+	provider.optional = false;
+	check_property_phandle_args(c, dti, node, prop, &provider);
 }
-WARNING(gpios_property, check_gpios_property, NULL, &phandle_references);
+WARNING_PROP(gpios_property, check_gpios_property, NULL,
+	     PROPS("gpios", "*-gpios", "gpio", "*-gpio"), &phandle_references);
 
 static void check_deprecated_gpio_property(struct check *c,
 					   struct dt_info *dti,
-				           struct node *node)
-{
-	struct property *prop;
-
-	for_each_property(node, prop) {
-		if (!prop_is_gpio(prop))
-			continue;
-
-		if (!strends(prop->name, "gpio"))
-			continue;
-
-		FAIL_PROP(c, dti, node, prop,
-			  "'[*-]gpio' is deprecated, use '[*-]gpios' instead");
-	}
-
-}
-CHECK(deprecated_gpio_property, check_deprecated_gpio_property, NULL);
-
-static bool node_is_interrupt_provider(struct node *node)
+				           struct node *node,
+					   struct property *prop)
 {
-	struct property *prop;
-
-	prop = get_property(node, "interrupt-controller");
-	if (prop)
-		return true;
-
-	prop = get_property(node, "interrupt-map");
-	if (prop)
-		return true;
-
-	return false;
+	FAIL_PROP(c, dti, node, prop,
+		  "'[*-]gpio' is deprecated, use '[*-]gpios' instead");
 }
+CHECK_PROP(deprecated_gpio_property, check_deprecated_gpio_property, NULL,
+	   PROPS("gpio", "*-gpio"));
 
 static void check_interrupt_provider(struct check *c,
 				     struct dt_info *dti,
@@ -1682,8 +2203,8 @@ static void check_interrupts_property(struct check *c,
 				      struct node *node)
 {
 	struct node *root = dti->dt;
-	struct node *irq_node = NULL, *parent = node;
-	struct property *irq_prop, *prop = NULL;
+	struct node *irq_node = NULL, *parent;
+	struct property *irq_prop, *prop;
 	cell_t irq_cells, phandle;
 
 	irq_prop = get_property(node, "interrupts");
@@ -1694,24 +2215,19 @@ static void check_interrupts_property(struct check *c,
 		FAIL_PROP(c, dti, node, irq_prop, "size (%d) is invalid, expected multiple of %zu",
 		     irq_prop->val.len, sizeof(cell_t));
 
-	while (parent && !prop) {
-		if (parent != node && node_is_interrupt_provider(parent)) {
-			irq_node = parent;
-			break;
-		}
-
+	parent = get_interrupt_parent_source(root, node);
+	if (parent && parent != node && node_is_interrupt_provider(parent)) {
+		irq_node = parent;
+	} else if (parent) {
 		prop = get_property(parent, "interrupt-parent");
-		if (prop) {
-			phandle = propval_cell(prop);
-			if (!phandle_is_valid(phandle)) {
-				/* Give up if this is an overlay with
-				 * external references */
-				if (dti->dtsflags & DTSF_PLUGIN)
-					return;
-				FAIL_PROP(c, dti, parent, prop, "Invalid phandle");
-				continue;
-			}
-
+		phandle = propval_cell(prop);
+		if (!phandle_is_valid(phandle)) {
+			/* Give up if this is an overlay with
+			 * external references */
+			if (dti->dtsflags & DTSF_PLUGIN)
+				return;
+			FAIL_PROP(c, dti, parent, prop, "Invalid phandle");
+		} else {
 			irq_node = get_node_by_phandle(root, phandle);
 			if (!irq_node) {
 				FAIL_PROP(c, dti, parent, prop, "Bad phandle");
@@ -1720,11 +2236,7 @@ static void check_interrupts_property(struct check *c,
 			if (!node_is_interrupt_provider(irq_node))
 				FAIL(c, dti, irq_node,
 				     "Missing interrupt-controller or interrupt-map property");
-
-			break;
 		}
-
-		parent = parent->parent;
 	}
 
 	if (!irq_node) {
@@ -1776,7 +2288,7 @@ static void check_graph_nodes(struct check *c, struct dt_info *dti,
 	}
 
 }
-WARNING(graph_nodes, check_graph_nodes, NULL);
+WARNING_FIXUP(graph_nodes, check_graph_nodes, NULL);
 
 static void check_graph_child_address(struct check *c, struct dt_info *dti,
 				      struct node *node)
@@ -2045,17 +2557,57 @@ void parse_checks_option(bool warn, bool error, const char *arg)
 	die("Unrecognized check name \"%s\"\n", name);
 }
 
+static int cmp_check_time(const void *ax, const void *bx)
+{
+	const struct check *a = *(const struct check * const *)ax;
+	const struct check *b = *(const struct check * const *)bx;
+
+	if (a->stats.time != b->stats.time)
+		return a->stats.time < b->stats.time ? 1 : -1;
+	return strcmp(a->name, b->name);
+}
+
+static void print_check_stats(void)
+{
+	struct check *tbl[ARRAY_SIZE(check_table)];
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(check_table); i++)
+		if (check_table[i]->status != UNCHECKED)
+			tbl[n++] = check_table[i];
+
+	qsort(tbl, n, sizeof(tbl[0]), cmp_check_time);
+
+	fprintf(stderr, "%-40s %11s %11s %8s %8s %8s\n", "check",
+		"time (ms)", "prereq (ms)", "nodes", "props", "failures");
+	for (i = 0; i < n; i++)
+		fprintf(stderr, "%-40s %11.3f %11.3f %8lu %8lu %8lu\n",
+			tbl[i]->name, tbl[i]->stats.time * 1000,
+			tbl[i]->stats.prereq_time * 1000, tbl[i]->stats.nodes,
+			tbl[i]->stats.props, tbl[i]->stats.failures);
+}
+
 void process_checks(bool force, struct dt_info *dti)
 {
 	unsigned int i;
 	int error = 0;
 
+	/* The same checks may be run on more than one tree */
+	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
+		check_table[i]->status = UNCHECKED;
+		memset(&check_table[i]->stats, 0, sizeof(check_table[i]->stats));
+	}
+
 	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
 		struct check *c = check_table[i];
 
 		if (c->warn || c->error)
 			error = error || run_check(c, dti);
 	}
+	run_queued_checks(dti);
+
+	if (check_stats)
+		print_check_stats();
 
 	if (error) {
 		if (!force) {
@@ -0,0 +1,1716 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Built-in C preprocessor for device tree sources.
+ *
+ * This covers what dts files get out of "cpp -nostdinc -undef -x
+ * assembler-with-cpp": #include, object and function-like macros with
+ * #, ## and variable arguments, #if and friends with integer
+ * expressions, #error, #warning and #pragma once.  As in assembler
+ * mode, lines such as "#address-cells = <1>;" which start with '#' but
+ * are not directives are passed on as text.
+ *
+ * The output keeps the lines of each source file where they were, and
+ * has line markers around included files, so the lexer still reports
+ * source positions correctly.  Comments are passed on untouched.
+ * Files are read once per run and kept in memory, however often they
+ * are included.
+ */
+
+#include "dtc.h"
+#include "srcpos.h"
+
+#define CPP_MAX_DEPTH		200
+#define MACRO_HASH_SIZE		1024
+
+enum cpp_toktype {
+	CT_EOF,
+	CT_IDENT,
+	CT_NUMBER,
+	CT_STRING,
+	CT_CHAR,
+	CT_PUNCT,
+	CT_SPACE,	/* blanks, comments and escaped newlines */
+	CT_NEWLINE,
+};
+
+struct cpp_token {
+	enum cpp_toktype type;
+	const char *p;
+	int len;
+	int lines;		/* newlines within */
+	bool noexpand;		/* names a macro which was being expanded */
+};
+
+struct cpp_toks {
+	struct cpp_token *t;
+	int n, size;
+};
+
+struct cpp_macro {
+	struct cpp_macro *next;		/* in its hash chain */
+	char *name;
+	bool funclike, variadic;
+	bool cmdline;			/* from --define */
+	bool disabled;			/* while its expansion is rescanned */
+	int nparams;
+	char **params;
+	struct cpp_toks body;
+};
+
+/* A source file, as read in */
+struct cpp_file {
+	struct cpp_file *next;
+	char *name;
+	char *dir;
+	char *text;
+	size_t len;
+	bool once;			/* has #pragma once */
+};
+
+/* Where we are in a file being preprocessed */
+struct cpp_input {
+	struct cpp_file *file;
+	const char *pos, *end;
+	int line;
+	bool bol;			/* at the start of a line */
+};
+
+/* Tokens being rescanned after a macro was replaced by them */
+struct cpp_source {
+	struct cpp_source *prev;
+	struct cpp_toks toks;
+	int i;
+	struct cpp_macro *macro;	/* disabled until they are used up */
+};
+
+/* Token stream: what macros expanded to, then the input, if any */
+struct cpp_reader {
+	struct cpp_source *top;
+	struct cpp_input *in;
+	bool collecting;		/* reading macro arguments */
+	int lines;			/* newlines read while collecting */
+};
+
+struct cpp_cond {
+	bool was_skipping;		/* before the #if */
+	bool taken;			/* a branch has been chosen */
+	bool seen_else;
+	int line;
+};
+
+static struct cpp_macro *macros[MACRO_HASH_SIZE];
+static struct cpp_file *files;
+static int cpp_errors;
+
+/* How much of the output of the input file has been looked at */
+static struct {
+	size_t pos;
+	int depth;			/* of braces */
+	bool bol;
+	bool after_statement;		/* the last token was a ';' */
+} top;
+
+static void PRINTF(3, 4) cpp_msg(struct cpp_input *in, const char *prefix,
+				 const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: %s:%d: ", prefix, in->file->name, in->line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+#define cpp_error(in, ...) \
+	do { \
+		cpp_errors++; \
+		cpp_msg((in), "Error", __VA_ARGS__); \
+	} while (0)
+
+/*
+ * Tokens
+ */
+
+static bool is_ident_start(char c)
+{
+	return isalpha((unsigned char)c) || (c == '_');
+}
+
+static bool is_ident_char(char c)
+{
+	return isalnum((unsigned char)c) || (c == '_');
+}
+
+static bool text_is(const char *p, int len, const char *s)
+{
+	return ((size_t)len == strlen(s)) && !memcmp(p, s, len);
+}
+
+static bool tok_is(const struct cpp_token *t, const char *s)
+{
+	return ((t->type == CT_PUNCT) || (t->type == CT_IDENT))
+		&& text_is(t->p, t->len, s);
+}
+
+static void lex(const char **pp, const char *end, struct cpp_token *t)
+{
+	static const char * const puncts[] = {
+		"...", "##", "&&", "||", "<<", ">>", "<=", ">=", "==", "!=",
+	};
+	const char *p = *pp;
+	unsigned int i;
+
+	t->p = p;
+	t->lines = 0;
+	t->noexpand = false;
+
+	if (p >= end) {
+		t->type = CT_EOF;
+	} else if (*p == '\n') {
+		t->type = CT_NEWLINE;
+		t->lines = 1;
+		p++;
+	} else if ((*p == '\\') && (p + 1 < end) && (p[1] == '\n')) {
+		t->type = CT_SPACE;
+		t->lines = 1;
+		p += 2;
+	} else if (*p && strchr(" \t\r\f\v", *p)) {
+		t->type = CT_SPACE;
+		while ((p < end) && *p && strchr(" \t\r\f\v", *p))
+			p++;
+	} else if ((*p == '/') && (p + 1 < end) && (p[1] == '*')) {
+		t->type = CT_SPACE;
+		for (p += 2; p < end; p++) {
+			if ((*p == '*') && (p + 1 < end) && (p[1] == '/')) {
+				p += 2;
+				break;
+			}
+			if (*p == '\n')
+				t->lines++;
+		}
+	} else if ((*p == '/') && (p + 1 < end) && (p[1] == '/')) {
+		t->type = CT_SPACE;
+		while ((p < end) && (*p != '\n'))
+			p++;
+	} else if (is_ident_start(*p)) {
+		t->type = CT_IDENT;
+		while ((p < end) && is_ident_char(*p))
+			p++;
+	} else if (isdigit((unsigned char)*p)
+		   || ((*p == '.') && (p + 1 < end)
+		       && isdigit((unsigned char)p[1]))) {
+		t->type = CT_NUMBER;
+		for (p++; p < end; p++) {
+			if (*p && strchr("+-", *p) && strchr("eEpP", p[-1]))
+				continue;
+			if (!is_ident_char(*p) && (*p != '.'))
+				break;
+		}
+	} else if ((*p == '"') || (*p == '\'')) {
+		const char *q = p + 1;
+
+		while ((q < end) && (*q != *p) && (*q != '\n')) {
+			if ((*q == '\\') && (q + 1 < end) && (q[1] != '\n'))
+				q++;
+			q++;
+		}
+		if ((q < end) && (*q == *p)) {
+			t->type = (*p == '"') ? CT_STRING : CT_CHAR;
+			p = q + 1;
+		} else if (*p == '"') {
+			/* Let the lexer complain about it */
+			t->type = CT_STRING;
+			p = q;
+		} else {
+			t->type = CT_PUNCT;
+			p++;
+		}
+	} else {
+		t->type = CT_PUNCT;
+		for (i = 0; i < ARRAY_SIZE(puncts); i++)
+			if (!strncmp(p, puncts[i], strlen(puncts[i]))
+			    && (p + strlen(puncts[i]) <= end))
+				break;
+		p += (i < ARRAY_SIZE(puncts)) ? strlen(puncts[i]) : 1;
+	}
+
+	t->len = p - t->p;
+	*pp = p;
+}
+
+static void toks_add(struct cpp_toks *v, const struct cpp_token *t)
+{
+	if (v->n == v->size) {
+		v->size = v->size ? v->size * 2 : 16;
+		v->t = xrealloc(v->t, v->size * sizeof(*v->t));
+	}
+	v->t[v->n++] = *t;
+}
+
+static void toks_add_all(struct cpp_toks *v, const struct cpp_toks *from)
+{
+	int i;
+
+	for (i = 0; i < from->n; i++)
+		toks_add(v, &from->t[i]);
+}
+
+static void toks_free(struct cpp_toks *v)
+{
+	free(v->t);
+	v->t = NULL;
+	v->n = v->size = 0;
+}
+
+static void tokenize(const char *p, const char *end, struct cpp_toks *v)
+{
+	struct cpp_token t;
+
+	for (lex(&p, end, &t); t.type != CT_EOF; lex(&p, end, &t))
+		toks_add(v, &t);
+}
+
+/* A token for new text, such as a stringified or pasted argument */
+static struct cpp_token new_token(enum cpp_toktype type, const char *p,
+				  int len)
+{
+	struct cpp_token t = { type, NULL, len, 0, false };
+	char *s = arena_alloc(len + 1);
+
+	memcpy(s, p, len);
+	s[len] = '\0';
+	t.p = s;
+	return t;
+}
+
+static int skip_spaces(const struct cpp_toks *v, int i)
+{
+	while ((i < v->n) && (v->t[i].type == CT_SPACE))
+		i++;
+	return i;
+}
+
+/*
+ * Macro table
+ */
+
+static unsigned int macro_hash(const char *name, int len)
+{
+	return str_hash(name, len) & (MACRO_HASH_SIZE - 1);
+}
+
+static struct cpp_macro **macro_slot(const char *name, int len)
+{
+	struct cpp_macro **m = &macros[macro_hash(name, len)];
+
+	while (*m && !text_is(name, len, (*m)->name))
+		m = &(*m)->next;
+
+	return m;
+}
+
+static struct cpp_macro *find_macro(const struct cpp_token *t)
+{
+	if (t->type != CT_IDENT)
+		return NULL;
+	return *macro_slot(t->p, t->len);
+}
+
+static void free_macro(struct cpp_macro *m)
+{
+	int i;
+
+	for (i = 0; i < m->nparams; i++)
+		free(m->params[i]);
+	free(m->params);
+	toks_free(&m->body);
+	free(m->name);
+	free(m);
+}
+
+static void undef_macro(const char *name, int len)
+{
+	struct cpp_macro **m = macro_slot(name, len);
+	struct cpp_macro *old = *m;
+
+	if (old) {
+		*m = old->next;
+		free_macro(old);
+	}
+}
+
+static int param_index(const struct cpp_macro *m, const struct cpp_token *t)
+{
+	int i;
+
+	if (!m->funclike || (t->type != CT_IDENT))
+		return -1;
+
+	for (i = 0; i < m->nparams; i++)
+		if (text_is(t->p, t->len, m->params[i]))
+			return i;
+
+	return -1;
+}
+
+/* Parse "(a, b, ...)" from line->t[i], returning the index after it */
+static int parse_params(struct cpp_macro *m, const struct cpp_toks *line,
+			int i)
+{
+	const struct cpp_token *t;
+
+	m->funclike = true;
+	m->params = xmalloc(line->n * sizeof(*m->params));
+
+	i = skip_spaces(line, i + 1);
+	if ((i < line->n) && tok_is(&line->t[i], ")"))
+		return i + 1;
+
+	while (i < line->n) {
+		t = &line->t[i];
+		if (tok_is(t, "...")) {
+			m->variadic = true;
+			m->params[m->nparams++] = xstrdup("__VA_ARGS__");
+		} else if (t->type == CT_IDENT) {
+			m->params[m->nparams++] = xstrndup(t->p, t->len);
+			i = skip_spaces(line, i + 1);
+			/* GNU named variable arguments, "args..." */
+			if ((i < line->n) && tok_is(&line->t[i], "...")) {
+				m->variadic = true;
+				i++;
+			}
+			i--;
+		} else {
+			break;
+		}
+
+		i = skip_spaces(line, i + 1);
+		if (i >= line->n)
+			break;
+		if (tok_is(&line->t[i], ")"))
+			return i + 1;
+		if (m->variadic || !tok_is(&line->t[i], ","))
+			break;
+		i = skip_spaces(line, i + 1);
+	}
+
+	return -1;
+}
+
+/* Parse "NAME body" or "NAME(params) body", as found after #define */
+static struct cpp_macro *define_macro(struct cpp_input *in,
+				      const struct cpp_toks *line, int i)
+{
+	struct cpp_macro *m, **slot;
+	const struct cpp_token *name;
+	int end;
+
+	i = skip_spaces(line, i);
+	if ((i >= line->n) || (line->t[i].type != CT_IDENT)) {
+		cpp_error(in, "macro names must be identifiers");
+		return NULL;
+	}
+	name = &line->t[i++];
+
+	m = xmalloc(sizeof(*m));
+	memset(m, 0, sizeof(*m));
+	m->name = xstrndup(name->p, name->len);
+
+	/* Only a '(' right after the name makes it function-like */
+	if ((i < line->n) && tok_is(&line->t[i], "(")) {
+		i = parse_params(m, line, i);
+		if (i < 0) {
+			cpp_error(in, "bad parameter list for macro \"%s\"",
+				  m->name);
+			free_macro(m);
+			return NULL;
+		}
+	}
+
+	/* The body, without blanks around it */
+	i = skip_spaces(line, i);
+	for (end = line->n; (end > i) && (line->t[end - 1].type == CT_SPACE);
+	     end--)
+		;
+	for (; i < end; i++)
+		toks_add(&m->body, &line->t[i]);
+
+	undef_macro(m->name, strlen(m->name));
+	slot = macro_slot(m->name, strlen(m->name));
+	*slot = m;
+	return m;
+}
+
+/*
+ * Macro expansion
+ */
+
+static void push_source(struct cpp_reader *r, struct cpp_toks *toks,
+			struct cpp_macro *m)
+{
+	struct cpp_source *s = xmalloc(sizeof(*s));
+
+	s->prev = r->top;
+	s->toks = *toks;
+	s->i = 0;
+	s->macro = m;
+	if (m)
+		m->disabled = true;
+	r->top = s;
+}
+
+static void pop_source(struct cpp_reader *r)
+{
+	struct cpp_source *s = r->top;
+
+	r->top = s->prev;
+	if (s->macro)
+		s->macro->disabled = false;
+	toks_free(&s->toks);
+	free(s);
+}
+
+static void input_next(struct cpp_input *in, struct cpp_token *t)
+{
+	lex(&in->pos, in->end, t);
+	if (t->type != CT_EOF) {
+		in->line += t->lines;
+		in->bol = (t->type == CT_NEWLINE);
+	}
+}
+
+static struct cpp_token reader_next(struct cpp_reader *r)
+{
+	struct cpp_token t;
+
+	while (r->top) {
+		struct cpp_source *s = r->top;
+
+		if (s->i < s->toks.n)
+			return s->toks.t[s->i++];
+		pop_source(r);
+	}
+
+	if (!r->in) {
+		t.type = CT_EOF;
+		return t;
+	}
+
+	input_next(r->in, &t);
+	/* Arguments end up on one line, the newlines come after */
+	if (r->collecting && t.lines) {
+		r->lines += t.lines;
+		t.type = CT_SPACE;
+		t.p = " ";
+		t.len = 1;
+		t.lines = 0;
+	}
+	return t;
+}
+
+/* Is the next token other than blanks an opening parenthesis? */
+static bool next_is_paren(struct cpp_reader *r)
+{
+	struct cpp_source *s;
+	struct cpp_input in;
+	struct cpp_token t;
+	int i;
+
+	for (s = r->top; s; s = s->prev) {
+		i = skip_spaces(&s->toks, s->i);
+		if (i < s->toks.n)
+			return tok_is(&s->toks.t[i], "(");
+	}
+
+	if (!r->in)
+		return false;
+
+	in = *r->in;
+	do {
+		input_next(&in, &t);
+	} while ((t.type == CT_SPACE) || (t.type == CT_NEWLINE));
+
+	return tok_is(&t, "(");
+}
+
+/* Read the arguments of a call to m, up to and including its ')' */
+static bool collect_args(struct cpp_input *in, struct cpp_reader *r,
+			 struct cpp_macro *m, struct cpp_toks *args)
+{
+	struct cpp_token t;
+	int depth = 0, n = 0;
+	bool ok = false;
+
+	r->collecting = true;
+	do {
+		t = reader_next(r);
+	} while (t.type == CT_SPACE);
+
+	for (t = reader_next(r); t.type != CT_EOF; t = reader_next(r)) {
+		if (tok_is(&t, "(")) {
+			depth++;
+		} else if (tok_is(&t, ")") && depth) {
+			depth--;
+		} else if (tok_is(&t, ")")) {
+			ok = true;
+			break;
+		} else if (tok_is(&t, ",") && !depth
+			   && !(m->variadic && (n >= m->nparams - 1))) {
+			n++;
+			continue;
+		}
+
+		if (n < m->nparams)
+			toks_add(&args[n], &t);
+		else if (!n && !m->nparams && (t.type != CT_SPACE))
+			n = 1;
+	}
+	r->collecting = false;
+
+	if (!ok) {
+		cpp_error(in, "unterminated argument list invoking macro \"%s\"",
+			  m->name);
+		return false;
+	}
+
+	/* "f()" passes one empty argument, or none if f takes none */
+	if (!m->nparams && !n)
+		return true;
+	if ((n + 1 == m->nparams)
+	    || (m->variadic && (n + 2 == m->nparams)))
+		return true;
+
+	cpp_error(in, "macro \"%s\" passed %d arguments, but takes %d",
+		  m->name, n + 1, m->nparams);
+	return false;
+}
+
+static void trim_spaces(struct cpp_toks *v)
+{
+	int i = skip_spaces(v, 0);
+
+	while ((v->n > i) && (v->t[v->n - 1].type == CT_SPACE))
+		v->n--;
+	if (i) {
+		memmove(v->t, v->t + i, (v->n - i) * sizeof(*v->t));
+		v->n -= i;
+	}
+}
+
+static struct cpp_token stringify_arg(const struct cpp_toks *arg)
+{
+	struct data d = empty_data;
+	struct cpp_token t;
+	int i, j;
+
+	d = data_append_byte(d, '"');
+	for (i = 0; i < arg->n; i++) {
+		const struct cpp_token *a = &arg->t[i];
+
+		if (a->type == CT_SPACE) {
+			if (d.val[d.len - 1] != ' ')
+				d = data_append_byte(d, ' ');
+			continue;
+		}
+		for (j = 0; j < a->len; j++) {
+			if (((a->type == CT_STRING) || (a->type == CT_CHAR))
+			    && ((a->p[j] == '"') || (a->p[j] == '\\')))
+				d = data_append_byte(d, '\\');
+			d = data_append_byte(d, a->p[j]);
+		}
+	}
+	d = data_append_byte(d, '"');
+
+	t = new_token(CT_STRING, d.val, d.len);
+	data_free(d);
+	return t;
+}
+
+/* Append from to v, pasting its first token onto the last one of v */
+static void paste_tokens(struct cpp_toks *v, const struct cpp_toks *from)
+{
+	struct cpp_token *last, t;
+	struct cpp_toks pasted = { 0 };
+	struct data d = empty_data;
+	int i;
+
+	if (!from->n)
+		return;
+	if (!v->n) {
+		toks_add_all(v, from);
+		return;
+	}
+
+	last = &v->t[v->n - 1];
+	d = data_append_data(d, last->p, last->len);
+	d = data_append_data(d, from->t[0].p, from->t[0].len);
+	t = new_token(CT_PUNCT, d.val, d.len);
+	data_free(d);
+
+	/*
+	 * As in assembler mode, text which does not make one token is
+	 * kept as it is
+	 */
+	tokenize(t.p, t.p + t.len, &pasted);
+
+	v->n--;
+	toks_add_all(v, &pasted);
+	toks_free(&pasted);
+	for (i = 1; i < from->n; i++)
+		toks_add(v, &from->t[i]);
+}
+
+static void expand_list(struct cpp_input *in, const struct cpp_toks *from,
+			struct cpp_toks *out);
+
+/* The tokens m with the given arguments is replaced with */
+static void substitute(struct cpp_input *in, struct cpp_macro *m,
+		       struct cpp_toks *args, struct cpp_toks *out)
+{
+	struct cpp_toks *expanded = NULL;
+	const struct cpp_toks *body = &m->body;
+	bool paste = false, after_paste = false, empty = false;
+	int i, j, p;
+
+	if (m->nparams) {
+		expanded = xmalloc(m->nparams * sizeof(*expanded));
+		memset(expanded, 0, m->nparams * sizeof(*expanded));
+		for (p = 0; p < m->nparams; p++)
+			expanded[p].n = -1;
+	}
+
+	for (i = 0; i < body->n; i++) {
+		struct cpp_token tok = body->t[i], *t = &tok;
+		struct cpp_toks one = { t, 1, 1 };
+		const struct cpp_toks *add = &one;
+
+		if (after_paste && (t->type == CT_SPACE))
+			continue;
+		after_paste = false;
+
+		j = skip_spaces(body, i + 1);
+
+		if (m->funclike && tok_is(t, "#") && (j < body->n)
+		    && ((p = param_index(m, &body->t[j])) >= 0)) {
+			struct cpp_token s = stringify_arg(&args[p]);
+
+			one.t = &s;
+			if (paste)
+				paste_tokens(out, &one);
+			else
+				toks_add(out, &s);
+			paste = empty = false;
+			i = j;
+			continue;
+		}
+
+		if (tok_is(t, "##")) {
+			while (out->n && (out->t[out->n - 1].type == CT_SPACE))
+				out->n--;
+			/* Nothing is pasted onto an empty argument */
+			paste = !empty;
+			after_paste = true;
+			continue;
+		}
+
+		p = param_index(m, t);
+		if (p >= 0) {
+			if (paste || ((j < body->n) && tok_is(&body->t[j], "##"))) {
+				add = &args[p];
+				/*
+				 * GNU ", ## __VA_ARGS__" drops the comma if
+				 * there are no variable arguments, and pastes
+				 * nothing otherwise
+				 */
+				if (paste && m->variadic && (p == m->nparams - 1)
+				    && out->n && tok_is(&out->t[out->n - 1], ",")) {
+					if (!add->n)
+						out->n--;
+					paste = false;
+				}
+			} else {
+				if (expanded[p].n < 0) {
+					expanded[p].n = 0;
+					expand_list(in, &args[p], &expanded[p]);
+				}
+				add = &expanded[p];
+			}
+		}
+
+		if (t->type != CT_SPACE)
+			empty = !paste && !add->n;
+		if (paste)
+			paste_tokens(out, add);
+		else
+			toks_add_all(out, add);
+		paste = false;
+	}
+
+	for (p = 0; p < m->nparams; p++)
+		if (expanded[p].n >= 0)
+			toks_free(&expanded[p]);
+	free(expanded);
+}
+
+/*
+ * If t names a macro, replace it and what it takes with the expansion,
+ * to be read next.  Returns false if t is to be kept as it is.
+ */
+static bool expand_macro(struct cpp_input *in, struct cpp_reader *r,
+			 struct cpp_token *t)
+{
+	struct cpp_macro *m = find_macro(t);
+	struct cpp_toks *args = NULL, out = { 0 };
+	int i;
+	bool ok = true;
+
+	if (!m || t->noexpand)
+		return false;
+
+	if (m->disabled) {
+		/* It stays as it is, even where it is rescanned later */
+		t->noexpand = true;
+		return false;
+	}
+
+	if (m->funclike) {
+		if (!next_is_paren(r))
+			return false;
+
+		args = xmalloc((m->nparams + 1) * sizeof(*args));
+		memset(args, 0, (m->nparams + 1) * sizeof(*args));
+		ok = collect_args(in, r, m, args);
+		for (i = 0; i < m->nparams; i++)
+			trim_spaces(&args[i]);
+	}
+
+	if (ok)
+		substitute(in, m, args, &out);
+
+	for (i = 0; args && (i <= m->nparams); i++)
+		toks_free(&args[i]);
+	free(args);
+
+	push_source(r, &out, m);
+	return true;
+}
+
+/* Fully expand a list of tokens on their own, as macro arguments are */
+static void expand_list(struct cpp_input *in, const struct cpp_toks *from,
+			struct cpp_toks *out)
+{
+	struct cpp_reader r = { NULL, NULL, false, 0 };
+	struct cpp_toks copy = { 0 };
+	struct cpp_token t;
+
+	toks_add_all(&copy, from);
+	push_source(&r, &copy, NULL);
+
+	for (t = reader_next(&r); t.type != CT_EOF; t = reader_next(&r))
+		if (!expand_macro(in, &r, &t))
+			toks_add(out, &t);
+}
+
+/*
+ * #if expressions
+ */
+
+struct cpp_expr {
+	struct cpp_input *in;
+	struct cpp_toks *toks;
+	int i;
+};
+
+static const struct cpp_token *expr_peek(struct cpp_expr *e)
+{
+	static const struct cpp_token eof = { CT_EOF, "", 0, 0, false };
+
+	return (e->i < e->toks->n) ? &e->toks->t[e->i] : &eof;
+}
+
+static long long expr_cond(struct cpp_expr *e, bool live);
+
+static long long parse_char(const struct cpp_token *t)
+{
+	const char *p = t->p + 1;
+	char *end;
+
+	if (*p != '\\')
+		return (unsigned char)*p;
+
+	switch (*++p) {
+	case 'n':
+		return '\n';
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case 'x':
+		return strtol(p + 1, &end, 16);
+	default:
+		if (isdigit((unsigned char)*p))
+			return strtol(p, &end, 8);
+		return (unsigned char)*p;
+	}
+}
+
+static long long expr_primary(struct cpp_expr *e, bool live)
+{
+	const struct cpp_token *t = expr_peek(e);
+	unsigned long long v;
+	char buf[64], *end;
+	long long r;
+
+	e->i++;
+	if (tok_is(t, "(")) {
+		r = expr_cond(e, live);
+		if (!tok_is(expr_peek(e), ")"))
+			cpp_error(e->in, "missing ')' in expression");
+		e->i++;
+		return r;
+	}
+	if (tok_is(t, "-"))
+		return -expr_primary(e, live);
+	if (tok_is(t, "+"))
+		return expr_primary(e, live);
+	if (tok_is(t, "!"))
+		return !expr_primary(e, live);
+	if (tok_is(t, "~"))
+		return ~expr_primary(e, live);
+
+	switch (t->type) {
+	case CT_NUMBER:
+		if (t->len >= (int)sizeof(buf))
+			break;
+		memcpy(buf, t->p, t->len);
+		buf[t->len] = '\0';
+		v = strtoull(buf, &end, 0);
+		while (*end && strchr("uUlL", *end))
+			end++;
+		if (*end)
+			break;
+		return v;
+	case CT_CHAR:
+		return parse_char(t);
+	case CT_IDENT:
+		/* Identifiers left after expansion count as 0 */
+		return 0;
+	default:
+		break;
+	}
+
+	if (t->type == CT_EOF)
+		cpp_error(e->in, "#if with no expression");
+	else
+		cpp_error(e->in, "token \"%.*s\" is not valid in #if expressions",
+			  t->len, t->p);
+	return 0;
+}
+
+static int binary_prec(const struct cpp_token *t)
+{
+	static const struct {
+		const char *op;
+		int prec;
+	} ops[] = {
+		{ "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 },
+		{ "==", 6 }, { "!=", 6 }, { "<", 7 }, { ">", 7 }, { "<=", 7 },
+		{ ">=", 7 }, { "<<", 8 }, { ">>", 8 }, { "+", 9 }, { "-", 9 },
+		{ "*", 10 }, { "/", 10 }, { "%", 10 },
+	};
+	unsigned int i;
+
+	if (t->type != CT_PUNCT)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(ops); i++)
+		if (text_is(t->p, t->len, ops[i].op))
+			return ops[i].prec;
+	return 0;
+}
+
+static long long expr_binary(struct cpp_expr *e, int min_prec, bool live)
+{
+	long long l = expr_primary(e, live), r;
+	const struct cpp_token *op;
+	int prec;
+
+	while ((prec = binary_prec(op = expr_peek(e))) >= min_prec) {
+		e->i++;
+		if (tok_is(op, "||")) {
+			r = expr_binary(e, prec + 1, live && !l);
+			l = l || r;
+		} else if (tok_is(op, "&&")) {
+			r = expr_binary(e, prec + 1, live && l);
+			l = l && r;
+		} else {
+			r = expr_binary(e, prec + 1, live);
+			if (tok_is(op, "|"))
+				l |= r;
+			else if (tok_is(op, "^"))
+				l ^= r;
+			else if (tok_is(op, "&"))
+				l &= r;
+			else if (tok_is(op, "=="))
+				l = l == r;
+			else if (tok_is(op, "!="))
+				l = l != r;
+			else if (tok_is(op, "<="))
+				l = l <= r;
+			else if (tok_is(op, ">="))
+				l = l >= r;
+			else if (tok_is(op, "<"))
+				l = l < r;
+			else if (tok_is(op, ">"))
+				l = l > r;
+			else if (tok_is(op, "<<"))
+				l = (unsigned long long)l << (r & 63);
+			else if (tok_is(op, ">>"))
+				l >>= (r & 63);
+			else if (tok_is(op, "+"))
+				l += r;
+			else if (tok_is(op, "-"))
+				l -= r;
+			else if (tok_is(op, "*"))
+				l *= r;
+			else if (!r) {
+				if (live)
+					cpp_error(e->in, "division by zero in #if");
+				l = 0;
+			} else if (tok_is(op, "/"))
+				l /= r;
+			else
+				l %= r;
+		}
+	}
+
+	return l;
+}
+
+static long long expr_cond(struct cpp_expr *e, bool live)
+{
+	long long c = expr_binary(e, 1, live), a, b;
+
+	if (!tok_is(expr_peek(e), "?"))
+		return c;
+
+	e->i++;
+	a = expr_cond(e, live && c);
+	if (!tok_is(expr_peek(e), ":"))
+		cpp_error(e->in, "missing ':' in expression");
+	e->i++;
+	b = expr_cond(e, live && !c);
+
+	return c ? a : b;
+}
+
+static bool eval_condition(struct cpp_input *in, const struct cpp_toks *line,
+			   int i)
+{
+	struct cpp_toks toks = { 0 }, expanded = { 0 }, clean = { 0 };
+	struct cpp_expr e = { in, &clean, 0 };
+	long long v;
+	int j;
+
+	/* "defined X" and "defined(X)" go before anything is expanded */
+	for (; i < line->n; i++) {
+		const struct cpp_token *t = &line->t[i];
+		struct cpp_token one;
+		bool paren;
+
+		if ((t->type != CT_IDENT) || !tok_is(t, "defined")) {
+			toks_add(&toks, t);
+			continue;
+		}
+
+		j = skip_spaces(line, i + 1);
+		paren = (j < line->n) && tok_is(&line->t[j], "(");
+		if (paren)
+			j = skip_spaces(line, j + 1);
+		if ((j >= line->n) || (line->t[j].type != CT_IDENT)) {
+			cpp_error(in, "operator \"defined\" requires an identifier");
+			break;
+		}
+		one = new_token(CT_NUMBER, find_macro(&line->t[j]) ? "1" : "0", 1);
+		toks_add(&toks, &one);
+		if (paren) {
+			j = skip_spaces(line, j + 1);
+			if ((j >= line->n) || !tok_is(&line->t[j], ")"))
+				cpp_error(in, "missing ')' after \"defined\"");
+		}
+		i = j;
+	}
+
+	expand_list(in, &toks, &expanded);
+	for (j = 0; j < expanded.n; j++)
+		if (expanded.t[j].type != CT_SPACE)
+			toks_add(&clean, &expanded.t[j]);
+
+	v = expr_cond(&e, true);
+	if (e.i < clean.n)
+		cpp_error(in, "missing binary operator before \"%.*s\"",
+			  clean.t[e.i].len, clean.t[e.i].p);
+
+	toks_free(&toks);
+	toks_free(&expanded);
+	toks_free(&clean);
+	return v != 0;
+}
+
+/*
+ * Files and directives
+ */
+
+static struct cpp_file *read_file(FILE *f, const char *name, const char *dir)
+{
+	struct cpp_file *file = xmalloc(sizeof(*file));
+	struct data d = empty_data;
+	char buf[4096];
+	size_t n;
+
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		d = data_append_data(d, buf, n);
+	if (ferror(f))
+		die("Error reading \"%s\": %s\n", name, strerror(errno));
+	/* So the lexer can look a little past the end */
+	d = data_append_zeroes(d, 4);
+	d.len -= 4;
+
+	memset(file, 0, sizeof(*file));
+	file->name = xstrdup(name);
+	file->dir = dir ? xstrdup(dir) : NULL;
+	file->text = d.val;
+	file->len = d.len;
+	file->next = files;
+	files = file;
+
+	return file;
+}
+
+static struct cpp_file *find_file(const char *name)
+{
+	struct cpp_file *file;
+
+	for (file = files; file; file = file->next)
+		if (streq(file->name, name))
+			return file;
+
+	return NULL;
+}
+
+static void out_line_marker(struct data *out, int line, const char *name)
+{
+	char *s;
+
+	xasprintf(&s, "# %d \"", line);
+	*out = data_append_data(*out, s, strlen(s));
+	free(s);
+	for (; *name; name++) {
+		if ((*name == '"') || (*name == '\\'))
+			*out = data_append_byte(*out, '\\');
+		*out = data_append_byte(*out, *name);
+	}
+	*out = data_append_data(*out, "\"\n", 2);
+}
+
+static void out_newlines(struct data *out, int n)
+{
+	while (n-- > 0)
+		*out = data_append_byte(*out, '\n');
+}
+
+static void out_token(struct data *out, const struct cpp_token *t)
+{
+	/* Keep what an expansion gave apart from what comes before */
+	if (out->len && is_ident_char(out->val[out->len - 1])
+	    && (t->len && is_ident_char(t->p[0])))
+		*out = data_append_byte(*out, ' ');
+
+	if ((t->type == CT_SPACE) && (t->p[0] == '\\'))
+		*out = data_append_byte(*out, '\n');
+	else
+		*out = data_append_data(*out, t->p, t->len);
+}
+
+/* Text from a file which goes out as it is, copied in one go */
+struct cpp_run {
+	const char *start, *end;
+};
+
+static void flush_run(struct data *out, struct cpp_run *run)
+{
+	if (run->start)
+		*out = data_append_data(*out, run->start,
+					run->end - run->start);
+	run->start = NULL;
+}
+
+static bool add_to_run(struct data *out, struct cpp_run *run,
+		       const struct cpp_token *t)
+{
+	if ((t->type == CT_SPACE) && (t->p[0] == '\\'))
+		return false;
+
+	if (run->start && (t->p == run->end)) {
+		run->end += t->len;
+		return true;
+	}
+
+	flush_run(out, run);
+	if (out->len && is_ident_char(out->val[out->len - 1])
+	    && t->len && is_ident_char(t->p[0]))
+		return false;
+
+	run->start = t->p;
+	run->end = t->p + t->len;
+	return true;
+}
+
+/*
+ * Read a directive line, joining escaped newlines and turning comments
+ * into blanks, and count the newlines it takes up.
+ */
+static char *directive_line(struct cpp_input *in, int *lines)
+{
+	struct data d = empty_data;
+	const char *run = in->pos;
+	struct cpp_token t;
+	char *s;
+
+	*lines = 0;
+	for (lex(&in->pos, in->end, &t); t.type != CT_EOF;
+	     lex(&in->pos, in->end, &t)) {
+		if (t.type == CT_NEWLINE) {
+			(*lines)++;
+			break;
+		}
+		if ((t.type == CT_SPACE) && strchr("/\\", t.p[0])) {
+			*lines += t.lines;
+			d = data_append_data(d, run, t.p - run);
+			d = data_append_byte(d, ' ');
+			run = in->pos;
+		}
+	}
+	d = data_append_data(d, run, t.p - run);
+
+	s = arena_alloc(d.len + 1);
+	memcpy(s, d.val, d.len);
+	s[d.len] = '\0';
+	data_free(d);
+	return s;
+}
+
+/*
+ * With --include-cache, a file included from the input file between
+ * top level statements is preprocessed on its own.  If all it holds is
+ * "/ { ... };" statements, the tree they build is parsed (or loaded)
+ * by the cache, and a placeholder "/ { };" statement on a line of
+ * TREECACHE_UNIT stands in for the text.
+ */
+
+/* So the lexer can look a little past the end */
+static void pad_output(struct data *d)
+{
+	*d = data_grow_for(*d, 4);
+	memset(d->val + d->len, 0, 4);
+}
+
+/* The next token of output text, past blanks and line markers */
+static void output_token(const char **pp, const char *end, bool *bol,
+			 struct cpp_token *t)
+{
+	const char *p;
+
+	for (;;) {
+		p = *pp;
+		if (*bol && (p < end) && (p[0] == '#') && (p[1] == ' ')
+		    && isdigit((unsigned char)p[2])) {
+			while ((p < end) && (*p != '\n'))
+				p++;
+			*pp = p;
+		}
+		lex(pp, end, t);
+		*bol = (t->type == CT_NEWLINE);
+		if ((t->type != CT_SPACE) && (t->type != CT_NEWLINE))
+			return;
+	}
+}
+
+static bool at_top_level(struct data *out)
+{
+	const char *p, *end;
+	struct cpp_token t;
+
+	pad_output(out);
+	p = out->val + top.pos;
+	end = out->val + out->len;
+	for (output_token(&p, end, &top.bol, &t); t.type != CT_EOF;
+	     output_token(&p, end, &top.bol, &t)) {
+		if (tok_is(&t, "{"))
+			top.depth++;
+		else if (tok_is(&t, "}"))
+			top.depth--;
+		top.after_statement = tok_is(&t, ";");
+	}
+	top.pos = out->len;
+
+	return !top.depth && top.after_statement;
+}
+
+static bool is_root_unit(struct data *text)
+{
+	enum { SLASH, BRACE, BODY, SEMICOLON } want = SLASH;
+	const char *p, *end, *slash = NULL;
+	struct cpp_token t;
+	bool bol = true;
+	int depth = 0, roots = 0;
+
+	pad_output(text);
+	p = text->val;
+	end = text->val + text->len;
+	for (output_token(&p, end, &bol, &t); t.type != CT_EOF;
+	     output_token(&p, end, &bol, &t)) {
+		/* /include/ and /incbin/ read files the cache can't see */
+		if ((t.p == slash) && (tok_is(&t, "include")
+				       || tok_is(&t, "incbin")))
+			return false;
+		slash = tok_is(&t, "/") ? p : NULL;
+
+		switch (want) {
+		case SLASH:
+			if (!tok_is(&t, "/"))
+				return false;
+			want = BRACE;
+			break;
+		case BRACE:
+			if (!tok_is(&t, "{"))
+				return false;
+			depth = 1;
+			want = BODY;
+			break;
+		case BODY:
+			if (tok_is(&t, "{"))
+				depth++;
+			else if (tok_is(&t, "}") && !--depth)
+				want = SEMICOLON;
+			break;
+		case SEMICOLON:
+			if (!tok_is(&t, ";"))
+				return false;
+			roots++;
+			want = SLASH;
+			break;
+		}
+	}
+
+	return (want == SLASH) && roots;
+}
+
+static void include_unit(struct data *out, struct data *text)
+{
+	int n = -1;
+
+	if (!cpp_errors && is_root_unit(text))
+		n = treecache_unit(text->val, text->len);
+
+	if (n >= 0) {
+		out_line_marker(out, n + 1, TREECACHE_UNIT);
+		*out = data_append_data(*out, "/ { };\n", 7);
+	} else {
+		*out = data_append_data(*out, text->val, text->len);
+	}
+	data_free(*text);
+}
+
+static void preprocess_file(struct data *out, struct cpp_file *file,
+			    int depth);
+
+static bool include_file(struct data *out, struct cpp_input *in,
+			 struct cpp_toks *line, int i, int next_line, int depth)
+{
+	struct cpp_toks expanded = { 0 };
+	struct cpp_file *file;
+	const struct cpp_token *t;
+	char *name, *fullname;
+	bool angled = false, included = false;
+	FILE *f;
+	int j;
+
+	i = skip_spaces(line, i);
+	if ((i < line->n) && (line->t[i].type != CT_STRING)
+	    && !tok_is(&line->t[i], "<")) {
+		/* #include MACRO */
+		struct cpp_toks rest = { line->t + i, line->n - i, 0 };
+
+		expand_list(in, &rest, &expanded);
+		line = &expanded;
+		i = skip_spaces(line, 0);
+	}
+
+	t = (i < line->n) ? &line->t[i] : NULL;
+	if (t && (t->type == CT_STRING) && (t->len >= 2)) {
+		name = xstrndup(t->p + 1, t->len - 2);
+	} else if (t && tok_is(t, "<")) {
+		struct data d = empty_data;
+
+		for (j = i + 1; (j < line->n) && !tok_is(&line->t[j], ">"); j++)
+			d = data_append_data(d, line->t[j].p, line->t[j].len);
+		d = data_append_byte(d, '\0');
+		name = xstrdup(d.val);
+		data_free(d);
+		angled = true;
+		if (j >= line->n) {
+			cpp_error(in, "missing terminating > character");
+			free(name);
+			goto out;
+		}
+	} else {
+		cpp_error(in, "#include expects \"FILENAME\" or <FILENAME>");
+		goto out;
+	}
+
+	if (depth >= CPP_MAX_DEPTH)
+		die("Includes nested too deeply\n");
+
+	f = srcfile_include_open(name, angled ? NULL : in->file->dir, angled,
+				 &fullname);
+	if (!f) {
+		cpp_error(in, "%s: No such file or directory", name);
+		free(name);
+		goto out;
+	}
+	free(name);
+
+	file = find_file(fullname);
+	if (!file) {
+		name = strrchr(fullname, '/');
+		if (name)
+			name = xstrndup(fullname, name - fullname);
+		file = read_file(f, fullname, name);
+		free(name);
+	}
+	fclose(f);
+	free(fullname);
+
+	if (!file->once) {
+		bool unit = (include_cache || keep_includes) && !depth
+			&& at_top_level(out);
+		struct data text = empty_data;
+		struct data *dst = unit ? &text : out;
+
+		out_line_marker(dst, 1, file->name);
+		preprocess_file(dst, file, depth + 1);
+		if (dst->len && (dst->val[dst->len - 1] != '\n'))
+			*dst = data_append_byte(*dst, '\n');
+		if (unit)
+			include_unit(out, &text);
+		out_line_marker(out, next_line, in->file->name);
+		included = true;
+	}
+
+out:
+	toks_free(&expanded);
+	return included;
+}
+
+/*
+ * Handle the directive at the start of the line, if it is one.  Lines
+ * starting with '#' which are not directives are left to be read as
+ * text, unless they are skipped.
+ */
+static bool directive(struct data *out, struct cpp_input *in,
+		      struct cpp_cond **conds, int *nconds, bool *skipping,
+		      int depth)
+{
+	struct cpp_input start = *in;
+	struct cpp_toks line = { 0 };
+	struct cpp_cond *c;
+	const struct cpp_token *name;
+	char *text;
+	int i, lines;
+	bool handled = true, included = false;
+
+	/* Only conditionals matter in a skipped block */
+	if (*skipping) {
+		struct cpp_token t;
+		const char *p = in->pos + 1;
+
+		do {
+			lex(&p, in->end, &t);
+		} while ((t.type == CT_SPACE) && !t.lines && (t.p[0] != '\\'));
+		if ((t.type == CT_IDENT) && !tok_is(&t, "if")
+		    && !tok_is(&t, "ifdef") && !tok_is(&t, "ifndef")
+		    && !tok_is(&t, "elif") && !tok_is(&t, "else")
+		    && !tok_is(&t, "endif"))
+			return false;
+	}
+
+	text = directive_line(in, &lines);
+	tokenize(text, text + strlen(text), &line);
+
+	/* line.t[0] is the '#' */
+	i = skip_spaces(&line, 1);
+	if (i >= line.n) {
+		/* The null directive */
+		goto done;
+	}
+	name = &line.t[i];
+	i++;
+
+	if (tok_is(name, "if") || tok_is(name, "ifdef")
+	    || tok_is(name, "ifndef")) {
+		bool v = false;
+
+		if (!(*nconds % 16))
+			*conds = xrealloc(*conds, (*nconds + 16) * sizeof(**conds));
+		c = &(*conds)[(*nconds)++];
+		c->was_skipping = *skipping;
+		c->seen_else = false;
+		c->line = start.line;
+
+		if (!*skipping && tok_is(name, "if")) {
+			v = eval_condition(in, &line, i);
+		} else if (!*skipping) {
+			i = skip_spaces(&line, i);
+			if ((i >= line.n) || (line.t[i].type != CT_IDENT))
+				cpp_error(in, "no macro name given in #%.*s directive",
+					  name->len, name->p);
+			else
+				v = !!find_macro(&line.t[i]);
+			if (tok_is(name, "ifndef"))
+				v = !v;
+		}
+		c->taken = *skipping || v;
+		*skipping = *skipping || !v;
+	} else if (tok_is(name, "elif") || tok_is(name, "else")
+		   || tok_is(name, "endif")) {
+		if (!*nconds) {
+			cpp_error(in, "#%.*s without #if", name->len, name->p);
+			goto done;
+		}
+		c = &(*conds)[*nconds - 1];
+
+		if (tok_is(name, "endif")) {
+			*skipping = c->was_skipping;
+			(*nconds)--;
+		} else if (c->seen_else) {
+			cpp_error(in, "#%.*s after #else", name->len, name->p);
+		} else if (tok_is(name, "else")) {
+			c->seen_else = true;
+			*skipping = c->taken;
+			c->taken = true;
+		} else if (c->taken) {
+			*skipping = true;
+		} else {
+			*skipping = !eval_condition(in, &line, i);
+			c->taken = !*skipping;
+		}
+	} else if (*skipping) {
+		handled = false;
+	} else if (tok_is(name, "define")) {
+		define_macro(in, &line, i);
+	} else if (tok_is(name, "undef")) {
+		i = skip_spaces(&line, i);
+		if ((i >= line.n) || (line.t[i].type != CT_IDENT))
+			cpp_error(in, "no macro name given in #undef directive");
+		else
+			undef_macro(line.t[i].p, line.t[i].len);
+	} else if (tok_is(name, "include")) {
+		included = include_file(out, in, &line, i, start.line + lines,
+					depth);
+	} else if (tok_is(name, "error") || tok_is(name, "warning")) {
+		int len = strlen(text) - (line.t[i - 1].p - text);
+
+		if (tok_is(name, "error"))
+			cpp_error(in, "#%.*s", len, line.t[i - 1].p);
+		else
+			cpp_msg(in, "Warning", "#%.*s", len, line.t[i - 1].p);
+	} else if (tok_is(name, "pragma")) {
+		i = skip_spaces(&line, i);
+		if ((i < line.n) && tok_is(&line.t[i], "once"))
+			in->file->once = true;
+	} else {
+		/* Not a directive, "#address-cells = <1>;" say */
+		handled = false;
+	}
+
+done:
+	toks_free(&line);
+	if (!handled) {
+		*in = start;
+		return false;
+	}
+
+	in->line = start.line + lines;
+	in->bol = true;
+	if (!included)
+		out_newlines(out, lines);
+	return true;
+}
+
+static void skip_line(struct data *out, struct cpp_input *in)
+{
+	struct cpp_token t;
+
+	do {
+		input_next(in, &t);
+		if (t.type != CT_EOF)
+			out_newlines(out, t.lines);
+	} while ((t.type != CT_NEWLINE) && (t.type != CT_EOF));
+}
+
+static void preprocess_file(struct data *out, struct cpp_file *file,
+			    int depth)
+{
+	struct cpp_input in = {
+		file, file->text, file->text + file->len, 1, true
+	};
+	struct cpp_reader r = { NULL, &in, false, 0 };
+	struct cpp_cond *conds = NULL;
+	int nconds = 0;
+	bool skipping = false, from_file;
+	struct cpp_token t;
+	struct cpp_run run = { NULL, NULL };
+
+	for (;;) {
+		while (r.top && (r.top->i >= r.top->toks.n))
+			pop_source(&r);
+
+		if (!r.top && in.bol) {
+			const char *bol = in.pos, *p = in.pos;
+
+			while ((p < in.end) && *p && strchr(" \t\f\v\r", *p))
+				p++;
+			if ((p < in.end) && (*p == '#')) {
+				flush_run(out, &run);
+				in.pos = p;
+				if (directive(out, &in, &conds, &nconds,
+					      &skipping, depth))
+					continue;
+			}
+			if (skipping) {
+				if (p >= in.end)
+					break;
+				flush_run(out, &run);
+				skip_line(out, &in);
+				continue;
+			}
+			/* Text, from the start of the line */
+			in.pos = bol;
+			in.bol = false;
+		}
+
+		from_file = !r.top;
+		t = reader_next(&r);
+		if (t.type == CT_EOF)
+			break;
+		if ((t.type == CT_IDENT) && expand_macro(&in, &r, &t))
+			continue;
+
+		/* Newlines inside a macro call come at the end of its line */
+		if ((t.type == CT_NEWLINE) && r.lines) {
+			flush_run(out, &run);
+			out_token(out, &t);
+			out_newlines(out, r.lines);
+			r.lines = 0;
+		} else if (!from_file || !add_to_run(out, &run, &t)) {
+			flush_run(out, &run);
+			out_token(out, &t);
+		}
+	}
+	flush_run(out, &run);
+	out_newlines(out, r.lines);
+
+	if (nconds) {
+		in.line = conds[nconds - 1].line;
+		cpp_error(&in, "unterminated #if");
+	}
+	free(conds);
+}
+
+void cpp_define(const char *def)
+{
+	static char cmdline_name[] = "<command-line>";
+	struct cpp_input in = { NULL, NULL, NULL, 0, false };
+	struct cpp_file cmdline = { 0 };
+	struct cpp_toks line = { 0 };
+	const char *eq = strchr(def, '=');
+	struct cpp_macro *m;
+	char *text;
+
+	cmdline.name = cmdline_name;
+	in.file = &cmdline;
+
+	/* NAME=VALUE defines NAME as VALUE, plain NAME as 1 */
+	if (eq)
+		xasprintf(&text, "%.*s %s", (int)(eq - def), def, eq + 1);
+	else
+		xasprintf(&text, "%s 1", def);
+
+	tokenize(text, text + strlen(text), &line);
+	m = define_macro(&in, &line, 0);
+	toks_free(&line);
+
+	if (!m)
+		die("Invalid macro definition \"%s\"\n", def);
+	m->cmdline = true;
+}
+
+/* Each input starts out with only the command line macros, like a cpp run */
+static void reset_macros(void)
+{
+	struct cpp_macro **m, *old;
+	struct cpp_file *file;
+	int i;
+
+	for (i = 0; i < MACRO_HASH_SIZE; i++) {
+		for (m = &macros[i]; *m; ) {
+			old = *m;
+			if (old->cmdline) {
+				m = &old->next;
+				continue;
+			}
+			*m = old->next;
+			free_macro(old);
+		}
+	}
+
+	for (file = files; file; file = file->next)
+		file->once = false;
+}
+
+char *cpp_preprocess(FILE *f, const char *fname, size_t *len)
+{
+	struct data out = empty_data;
+	struct cpp_file *file;
+	static bool predefined;
+	const char *slash;
+	char *dir = NULL;
+
+	if (!predefined) {
+		cpp_define("__DTS__");
+		predefined = true;
+	}
+	reset_macros();
+
+	cpp_errors = 0;
+	memset(&top, 0, sizeof(top));
+	top.bol = true;
+
+	file = find_file(fname);
+	if (!file || streq(fname, "<stdin>")) {
+		slash = strrchr(fname, '/');
+		if (slash)
+			dir = xstrndup(fname, slash - fname);
+		file = read_file(f, fname, dir);
+		free(dir);
+	}
+	out_line_marker(&out, 1, file->name);
+	preprocess_file(&out, file, 0);
+
+	if (cpp_errors)
+		die("Unable to preprocess input tree\n");
+
+	*len = out.len;
+	return out.val;
+}
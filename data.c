@@ -13,7 +13,6 @@ void data_free(struct data d)
 	while (m) {
 		nm = m->next;
 		free(m->ref);
-		free(m);
 		m = nm;
 	}
 
@@ -23,22 +22,23 @@ void data_free(struct data d)
 
 struct data data_grow_for(struct data d, unsigned int xlen)
 {
-	struct data nd;
 	unsigned int newsize;
 
-	if (xlen == 0)
-		return d;
-
-	nd = d;
+	if ((d.len + xlen) < d.len)
+		die("Overflow growing data\n");
 
-	newsize = xlen;
+	if ((d.len + xlen) <= d.size)
+		return d;
 
-	while ((d.len + xlen) > newsize)
-		newsize *= 2;
+	/* Grow geometrically, so that appends are amortised O(1) */
+	newsize = d.size * 2;
+	if (newsize < (d.len + xlen))
+		newsize = d.len + xlen;
 
-	nd.val = xrealloc(d.val, newsize);
+	d.val = xrealloc(d.val, newsize);
+	d.size = newsize;
 
-	return nd;
+	return d;
 }
 
 struct data data_copy_mem(const char *mem, int len)
@@ -127,6 +127,108 @@ struct data data_insert_at_marker(struct data d, struct marker *m,
 	return d;
 }
 
+/*
+ * Insert the value fn() gives for each marker of the given type at that
+ * marker, building the new value in a single copy.  Markers for which
+ * fn() returns NULL are left alone.
+ */
+struct data data_insert_at_markers(struct data d, enum markertype type,
+				   marker_value_fn fn, void *arg)
+{
+	struct marker *m;
+	struct {
+		const void *p;
+		int len;
+	} *ins;
+	unsigned int n = 0, i;
+	unsigned int total = 0, added = 0, src = 0, prev = 0;
+	bool sorted = true;
+	struct data nd = empty_data;
+
+	m = d.markers;
+	for_each_marker(m) {
+		if (m->offset < prev)
+			sorted = false;
+		prev = m->offset;
+		if (m->type == type)
+			n++;
+	}
+	if (!n)
+		return d;
+
+	/* Get every value first, in marker order */
+	ins = xmalloc(n * sizeof(*ins));
+	i = 0;
+	m = d.markers;
+	for_each_marker_of_type(m, type) {
+		ins[i].len = 0;
+		ins[i].p = fn(m, &ins[i].len, arg);
+		total += ins[i].len;
+		i++;
+	}
+
+	if (!total) {
+		free(ins);
+		return d;
+	}
+
+	if (!sorted) {
+		i = 0;
+		m = d.markers;
+		for_each_marker_of_type(m, type) {
+			if (ins[i].p)
+				d = data_insert_at_marker(d, m, ins[i].p,
+							  ins[i].len);
+			i++;
+		}
+		free(ins);
+		return d;
+	}
+
+	/* Then copy the value over with them in between, shifting markers */
+	nd = data_grow_for(nd, d.len + total);
+	i = 0;
+	m = d.markers;
+	for_each_marker(m) {
+		unsigned int offset = m->offset;
+
+		m->offset += added;
+		if (m->type != type)
+			continue;
+
+		if (ins[i].p) {
+			memcpy(nd.val + nd.len, d.val + src, offset - src);
+			nd.len += offset - src;
+			memcpy(nd.val + nd.len, ins[i].p, ins[i].len);
+			nd.len += ins[i].len;
+			src = offset;
+			added += ins[i].len;
+		}
+		i++;
+	}
+	memcpy(nd.val + nd.len, d.val + src, d.len - src);
+	nd.len += d.len - src;
+	nd.markers = d.markers;
+
+	free(d.val);
+	free(ins);
+	return nd;
+}
+
+static struct marker *data_new_marker(unsigned int offset,
+				      enum markertype type, char *ref)
+{
+	struct marker *m;
+
+	m = arena_alloc(sizeof(*m));
+	m->offset = offset;
+	m->type = type;
+	m->ref = ref;
+	m->next = NULL;
+
+	return m;
+}
+
 static struct data data_append_markers(struct data d, struct marker *m)
 {
 	struct marker **mp = &d.markers;
@@ -226,15 +328,38 @@ struct data data_append_align(struct data d, int align)
 
 struct data data_add_marker(struct data d, enum markertype type, char *ref)
 {
-	struct marker *m;
+	return data_append_markers(d, data_new_marker(d.len, type, ref));
+}
 
-	m = xmalloc(sizeof(*m));
-	m->offset = d.len;
-	m->type = type;
-	m->ref = ref;
-	m->next = NULL;
+struct data_builder data_builder_start(enum markertype type)
+{
+	struct data_builder b;
+
+	b.data = data_add_marker(empty_data, type, NULL);
+	b.last = b.data.markers;
+
+	return b;
+}
+
+struct data_builder data_builder_append_integer(struct data_builder b,
+						uint64_t value, int bits)
+{
+	b.data = data_append_integer(b.data, value, bits);
+	return b;
+}
+
+struct data_builder data_builder_add_marker(struct data_builder b,
+					    enum markertype type, char *ref)
+{
+	struct marker *m = data_new_marker(b.data.len, type, ref);
+
+	if (b.last)
+		b.last->next = m;
+	else
+		b.data.markers = m;
+	b.last = m;
 
-	return data_append_markers(d, m);
+	return b;
 }
 
 bool data_is_one_string(struct data d)
@@ -0,0 +1,541 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Generation of an overlay which turns one tree into another.
+ */
+
+#include "dtc.h"
+
+/*
+ * The overlay has a single fragment targetting the root of the base tree,
+ * so a node at path /foo in the new tree lives at OVERLAY_PATH/foo.
+ */
+#define OVERLAY_PATH	"/fragment@0/__overlay__"
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+struct diff_state {
+	struct dt_info *old, *new;
+	struct node *overlay;		/* the __overlay__ node */
+	cell_t old_max_phandle;
+	bool force;
+	int errors;
+};
+
+static void PRINTF(3, 4) diff_error(struct diff_state *d, struct node *node,
+				    const char *fmt, ...)
+{
+	va_list ap;
+
+	d->errors++;
+	if (quiet >= (d->force ? 1 : 2))
+		return;
+
+	fprintf(stderr, "%s: %s: ", d->force ? "Warning" : "ERROR",
+		node->fullpath);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+/*
+ * Subtree hashing
+ *
+ * Every node gets a hash covering its name, its properties and all of its
+ * descendants, so that identical subtrees of the two trees can be skipped
+ * without comparing them.  Properties and children are combined with a
+ * sum, which makes the hash independent of their order.
+ */
+
+static uint64_t hash_mem(uint64_t h, const void *p, size_t len)
+{
+	const unsigned char *s = p;
+
+	while (len--) {
+		h ^= *s++;
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+static uint64_t hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static bool is_phandle_prop(struct property *prop)
+{
+	return streq(prop->name, "phandle") || streq(prop->name, "linux,phandle");
+}
+
+/* Nodes dtc generates itself, and which are not part of the difference */
+static bool is_generated_node(struct node *node)
+{
+	return node->parent && !node->parent->parent
+		&& (streq(node->name, "__symbols__")
+		    || streq(node->name, "__fixups__")
+		    || streq(node->name, "__local_fixups__"));
+}
+
+/*
+ * A phandle reference is hashed as the path of the node it points to, so
+ * that a renumbering of phandles doesn't make a property look changed.
+ */
+static uint64_t hash_property(struct node *root, struct property *prop)
+{
+	struct marker *m = prop->val.markers;
+	unsigned int off = 0;
+	uint64_t h;
+
+	h = hash_mem(FNV_OFFSET, prop->name, strlen(prop->name) + 1);
+	h = hash_mem(h, &prop->val.len, sizeof(prop->val.len));
+
+	for_each_marker_of_type(m, REF_PHANDLE) {
+		struct node *refnode = get_node_by_ref(root, m->ref);
+		const char *target = refnode ? refnode->fullpath : m->ref;
+
+		h = hash_mem(h, prop->val.val + off, m->offset - off);
+		h = hash_mem(h, target, strlen(target) + 1);
+		off = m->offset + sizeof(cell_t);
+	}
+
+	return hash_mem(h, prop->val.val + off, prop->val.len - off);
+}
+
+static uint64_t hash_tree(struct node *root, struct node *node)
+{
+	struct property *prop;
+	struct node *child;
+	uint64_t h, sum = 0;
+
+	for_each_property(node, prop) {
+		/*
+		 * The phandle of a node which is referenced from markers is
+		 * an artefact of the allocation order, the references
+		 * themselves are compared by target.
+		 */
+		if (is_phandle_prop(prop) && node->is_referenced)
+			continue;
+		sum += hash_mix(hash_property(root, prop));
+	}
+
+	for_each_child(node, child) {
+		if (is_generated_node(child))
+			continue;
+		sum += hash_mix(hash_tree(root, child));
+	}
+
+	h = hash_mem(FNV_OFFSET, node->name, strlen(node->name) + 1);
+	node->hash = hash_mix(hash_mem(h, &sum, sizeof(sum)));
+
+	return node->hash;
+}
+
+/*
+ * Property comparison
+ */
+
+static struct node *old_node_by_path(struct diff_state *d, const char *path)
+{
+	if (streq(path, "/"))
+		return d->old->dt;
+	return get_node_by_path(d->old->dt, path);
+}
+
+/*
+ * Compare a property of the old tree with its counterpart in the new one.
+ * A phandle reference in the new value matches any cell in the old value
+ * which points to a node at the same path.
+ */
+static bool same_value(struct diff_state *d, struct property *oldprop,
+		       struct property *prop)
+{
+	struct marker *m = prop->val.markers;
+	unsigned int off = 0;
+
+	if (oldprop->val.len != prop->val.len)
+		return false;
+
+	for_each_marker_of_type(m, REF_PHANDLE) {
+		struct node *refnode, *oldref;
+		cell_t phandle;
+
+		if (memcmp(oldprop->val.val + off, prop->val.val + off,
+			   m->offset - off) != 0)
+			return false;
+		off = m->offset + sizeof(cell_t);
+
+		phandle = dtb_ld32(oldprop->val.val + m->offset);
+		if (!phandle_is_valid(phandle))
+			return false;
+
+		refnode = get_node_by_ref(d->new->dt, m->ref);
+		oldref = get_node_by_phandle(d->old->dt, phandle);
+		if (!refnode || !oldref
+		    || !streq(refnode->fullpath, oldref->fullpath))
+			return false;
+	}
+
+	return memcmp(oldprop->val.val + off, prop->val.val + off,
+		      prop->val.len - off) == 0;
+}
+
+/*
+ * Overlay construction
+ */
+
+static struct property *copy_property(struct property *prop)
+{
+	struct data d = data_copy_mem(prop->val.val, prop->val.len);
+	struct marker *m, *nm, **tail = &d.markers;
+
+	for (m = prop->val.markers; m; m = m->next) {
+		/* Path references and labels are already in the value */
+		if ((m->type == REF_PATH) || (m->type == LABEL))
+			continue;
+
+		nm = arena_alloc(sizeof(*nm));
+		*nm = *m;
+		nm->ref = m->ref ? xstrdup(m->ref) : NULL;
+		nm->next = NULL;
+
+		*tail = nm;
+		tail = &nm->next;
+	}
+
+	return build_property(xstrdup(prop->name), d, prop->srcpos);
+}
+
+/*
+ * libfdt adds the largest phandle of the base tree to every phandle the
+ * overlay defines.  A phandle which the new tree gives to a node without
+ * one in the old tree is kept as is in the final tree when it is above
+ * that; otherwise it has to be left to dtc to allocate, which is only
+ * possible when all references to the node are known.
+ */
+static struct property *diff_phandle(struct diff_state *d,
+				     struct node *oldnode, struct node *node,
+				     struct property *prop)
+{
+	struct data val = empty_data;
+
+	if (oldnode && phandle_is_valid(oldnode->phandle)) {
+		if ((oldnode->phandle != node->phandle) && !node->is_referenced)
+			diff_error(d, node, "phandle changed from 0x%x to 0x%x",
+				   oldnode->phandle, node->phandle);
+		return NULL;
+	}
+
+	if (node->phandle <= d->old_max_phandle) {
+		if (!node->is_referenced)
+			diff_error(d, node, "phandle 0x%x is already used in the old tree",
+				   node->phandle);
+		return NULL;
+	}
+
+	val = data_add_marker(val, TYPE_UINT32, NULL);
+	val = data_append_cell(val, node->phandle - d->old_max_phandle);
+
+	return build_property(xstrdup(prop->name), val, prop->srcpos);
+}
+
+static struct node *copy_node(struct diff_state *d, struct node *node)
+{
+	struct node *copy, *child;
+	struct property *prop, *p;
+	struct label *l;
+
+	copy = build_node(NULL, NULL, node->srcpos);
+	name_node(copy, xstrdup(node->name));
+
+	for_each_label(node->labels, l)
+		add_label(&copy->labels, xstrdup(l->label));
+
+	for_each_property(node, prop) {
+		if (is_phandle_prop(prop))
+			p = diff_phandle(d, NULL, node, prop);
+		else
+			p = copy_property(prop);
+		if (p)
+			add_property(copy, p);
+	}
+
+	for_each_child(node, child)
+		add_child(copy, copy_node(d, child));
+
+	return copy;
+}
+
+static void diff_children(struct diff_state *d, struct node *ov,
+			  struct node *old, struct node *new);
+
+static struct node *diff_node(struct diff_state *d, struct node *old,
+			      struct node *new)
+{
+	struct node *ov;
+
+	if (old->hash == new->hash)
+		return NULL;
+
+	ov = build_node(NULL, NULL, new->srcpos);
+	name_node(ov, xstrdup(new->name));
+
+	diff_children(d, ov, old, new);
+
+	if (!ov->proplist && !ov->children) {
+		free(ov->name);
+		return NULL;
+	}
+
+	return ov;
+}
+
+/* Fill ov with the properties and subnodes which turn old into new */
+static void diff_children(struct diff_state *d, struct node *ov,
+			  struct node *old, struct node *new)
+{
+	struct property *prop, *oldprop, *p;
+	struct node *child, *oldchild, *c;
+
+	for_each_property(new, prop) {
+		oldprop = get_property(old, prop->name);
+
+		if (is_phandle_prop(prop))
+			p = diff_phandle(d, old, new, prop);
+		else if (oldprop && same_value(d, oldprop, prop))
+			p = NULL;
+		else
+			p = copy_property(prop);
+
+		if (p)
+			add_property(ov, p);
+	}
+
+	for_each_property(old, oldprop)
+		if (!is_phandle_prop(oldprop) && !get_property(new, oldprop->name))
+			diff_error(d, new, "property '%s' was removed",
+				   oldprop->name);
+
+	for_each_child(new, child) {
+		if (is_generated_node(child))
+			continue;
+
+		oldchild = get_subnode(old, child->name);
+		if (oldchild)
+			c = diff_node(d, oldchild, child);
+		else
+			c = copy_node(d, child);
+
+		if (c)
+			add_child(ov, c);
+	}
+
+	for_each_child(old, oldchild)
+		if (!is_generated_node(oldchild) && !get_subnode(new, oldchild->name))
+			diff_error(d, new, "subnode '%s' was removed",
+				   oldchild->name);
+}
+
+/*
+ * Reference resolution
+ */
+
+static char *overlay_ref(const char *path)
+{
+	char *ref;
+
+	if (streq(path, "/"))
+		return xstrdup(OVERLAY_PATH);
+
+	xasprintf(&ref, "%s%s", OVERLAY_PATH, path);
+	return ref;
+}
+
+/* Make sure the overlay has a node at path, so it can carry a phandle */
+static void add_overlay_path(struct diff_state *d, const char *path)
+{
+	struct node *node = d->overlay, *child;
+	const char *p = path, *end;
+	char *name;
+
+	while (*p) {
+		while (*p == '/')
+			p++;
+		if (!*p)
+			break;
+
+		end = strchr(p, '/');
+		if (!end)
+			end = p + strlen(p);
+		name = xstrndup(p, end - p);
+
+		child = get_subnode(node, name);
+		if (!child) {
+			child = build_node(NULL, NULL, NULL);
+			name_node(child, name);
+			add_child(node, child);
+		} else {
+			free(name);
+		}
+
+		node = child;
+		p = end;
+	}
+}
+
+/* Symbol under which the base tree exports node, if any */
+static const char *base_symbol(struct diff_state *d, struct node *node)
+{
+	struct node *symbols = get_subnode(d->old->dt, "__symbols__");
+	struct property *prop;
+
+	if (!symbols)
+		return NULL;
+
+	for_each_property(symbols, prop)
+		if ((prop->val.len == strlen(node->fullpath) + 1)
+		    && streq(prop->val.val, node->fullpath))
+			return prop->name;
+
+	return NULL;
+}
+
+/*
+ * Point a phandle reference copied from the new tree at something the
+ * overlay can resolve.  Returns false if the reference was replaced by
+ * a plain phandle value and the marker is to be dropped.
+ */
+static bool resolve_reference(struct diff_state *d, struct property *prop,
+			      struct marker *m, struct node *refnode)
+{
+	struct node *oldref = old_node_by_path(d, refnode->fullpath);
+	const char *label;
+
+	free(m->ref);
+
+	/* A node the overlay adds: a local fixup */
+	if (!oldref) {
+		m->ref = overlay_ref(refnode->fullpath);
+		return true;
+	}
+
+	/* A node the base exports a symbol for: an external fixup */
+	label = base_symbol(d, oldref);
+	if (label) {
+		m->ref = xstrdup(label);
+		return true;
+	}
+
+	/* A node with a phandle in the base: use it directly */
+	if (phandle_is_valid(oldref->phandle)) {
+		m->ref = NULL;
+		*((fdt32_t *)(prop->val.val + m->offset)) =
+			cpu_to_fdt32(oldref->phandle);
+		return false;
+	}
+
+	/* Otherwise the overlay has to give the base node a phandle */
+	add_overlay_path(d, refnode->fullpath);
+	m->ref = overlay_ref(refnode->fullpath);
+	return true;
+}
+
+static void resolve_references(struct diff_state *d, struct node *node)
+{
+	struct property *prop;
+	struct marker **mp, *m;
+	struct node *refnode, *child;
+
+	for_each_property(node, prop) {
+		mp = &prop->val.markers;
+		while ((m = *mp)) {
+			/*
+			 * References which don't resolve in the new tree
+			 * (the new tree is itself an overlay) stay fixups.
+			 */
+			if (m->type == REF_PHANDLE) {
+				refnode = get_node_by_ref(d->new->dt, m->ref);
+				if (refnode
+				    && !resolve_reference(d, prop, m, refnode)) {
+					*mp = m->next;
+					continue;
+				}
+			}
+			mp = &m->next;
+		}
+	}
+
+	for_each_child(node, child)
+		resolve_references(d, child);
+}
+
+static bool same_reservations(struct reserve_info *a, struct reserve_info *b)
+{
+	while (a && b) {
+		if ((a->address != b->address) || (a->size != b->size))
+			return false;
+		a = a->next;
+		b = b->next;
+	}
+
+	return !a && !b;
+}
+
+struct dt_info *dt_diff(struct dt_info *old, struct dt_info *new, bool force)
+{
+	struct diff_state d = {
+		.old = old,
+		.new = new,
+		.force = force,
+	};
+	struct node *root, *fragment;
+	struct data val = empty_data;
+
+	if (!same_reservations(old->reservelist, new->reservelist))
+		diff_error(&d, new->dt, "memory reservations differ");
+	if (old->boot_cpuid_phys != new->boot_cpuid_phys)
+		diff_error(&d, new->dt, "boot cpuid differs");
+
+	/* Let the nodes copied from a blob carry their symbols */
+	add_symbol_labels(new->dt);
+
+	hash_tree(old->dt, old->dt);
+	hash_tree(new->dt, new->dt);
+	d.old_max_phandle = get_max_phandle(old->dt);
+
+	d.overlay = build_node(NULL, NULL, NULL);
+	name_node(d.overlay, xstrdup("__overlay__"));
+	if (old->dt->hash != new->dt->hash)
+		diff_children(&d, d.overlay, old->dt, new->dt);
+
+	resolve_references(&d, d.overlay);
+
+	if (d.errors) {
+		if (!force)
+			die("Trees differ in ways an overlay can't express, "
+			    "aborting (use -f to force output)\n");
+		else if (quiet < 3)
+			fprintf(stderr, "Warning: Trees differ in ways an "
+				"overlay can't express, output forced\n");
+	}
+
+	val = data_add_marker(val, TYPE_STRING, NULL);
+	val = data_append_data(val, "/", 2);
+
+	fragment = build_node(build_property(xstrdup("target-path"), val, NULL),
+			      d.overlay, NULL);
+	name_node(fragment, xstrdup("fragment@0"));
+
+	root = build_node(NULL, fragment, NULL);
+	name_node(root, xstrdup(""));
+
+	return build_dt_info(DTSF_V1 | DTSF_PLUGIN, NULL, root, 0);
+}
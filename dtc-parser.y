@@ -23,6 +23,7 @@ extern void yyerror(char const *s);
 
 extern struct dt_info *parser_output;
 extern bool treesource_error;
+extern bool treesource_warning;
 
 static bool is_ref_relative(const char *ref)
 {
@@ -36,10 +37,11 @@ static bool is_ref_relative(const char *ref)
 	char *labelref;
 	uint8_t byte;
 	struct data data;
+	struct data_builder builder;
 
 	struct {
-		struct data	data;
-		int		bits;
+		struct data_builder	builder;
+		int			bits;
 	} array;
 
 	struct property *prop;
@@ -76,7 +78,7 @@ static bool is_ref_relative(const char *ref)
 %type <re> memreserve
 %type <re> memreserves
 %type <array> arrayprefix
-%type <data> bytestring
+%type <builder> bytestring
 %type <prop> propdef
 %type <proplist> proplist
 %type <labelref> dt_ref
@@ -160,11 +162,11 @@ dt_ref: DT_LABEL_REF | DT_PATH_REF;
 devicetree:
 	  '/' nodedef
 		{
-			$$ = name_node($2, "");
+			$$ = name_node(treecache_merge(NULL, $2), xstrdup(""));
 		}
 	| devicetree '/' nodedef
 		{
-			$$ = merge_nodes($1, $3);
+			$$ = treecache_merge($1, $3);
 		}
 	| dt_ref nodedef
 		{
@@ -179,7 +181,7 @@ devicetree:
 				ERROR(&@2, "Label-relative reference %s not supported in plugin", $1);
 			$$ = add_orphan_node(
 					name_node(build_node(NULL, NULL, NULL),
-						  ""),
+						  xstrdup("")),
 					$2, $1);
 		}
 	| devicetree DT_LABEL dt_ref nodedef
@@ -190,10 +192,13 @@ devicetree:
 				ERROR(&@2, "Label-relative reference %s not supported in plugin", $3);
 
 			if (target) {
-				add_label(&target->labels, $2);
+				add_node_label(target, $2);
 				merge_nodes(target, $4);
-			} else
+			} else {
 				ERROR(&@3, "Label or path %s not found", $3);
+				free($2);
+			}
+			free($3);
 			$$ = $1;
 		}
 	| devicetree DT_PATH_REF nodedef
@@ -214,6 +219,7 @@ devicetree:
 					merge_nodes(target, $3);
 				else
 					ERROR(&@2, "Label or path %s not found", $2);
+				free($2);
 			}
 			$$ = $1;
 		}
@@ -223,6 +229,7 @@ devicetree:
 
 			if (target) {
 				merge_nodes(target, $3);
+				free($2);
 			} else {
 				/*
 				 * We rely on the rule being always:
@@ -244,7 +251,7 @@ devicetree:
 				delete_node(target);
 			else
 				ERROR(&@3, "Label or path %s not found", $3);
-
+			free($3);
 
 			$$ = $1;
 		}
@@ -256,7 +263,7 @@ devicetree:
 				omit_node_if_unused(target);
 			else
 				ERROR(&@3, "Label or path %s not found", $3);
-
+			free($3);
 
 			$$ = $1;
 		}
@@ -307,15 +314,15 @@ propdata:
 		}
 	| propdataprefix arrayprefix '>'
 		{
-			$$ = data_merge($1, $2.data);
+			$$ = data_merge($1, $2.builder.data);
 		}
 	| propdataprefix '[' bytestring ']'
 		{
-			$$ = data_merge($1, $3);
+			$$ = data_merge($1, $3.data);
 		}
 	| propdataprefix dt_ref
 		{
-			$1 = data_add_marker($1, TYPE_STRING, $2);
+			$1 = data_add_marker($1, TYPE_STRING, xstrdup($2));
 			$$ = data_add_marker($1, REF_PATH, $2);
 		}
 	| propdataprefix DT_INCBIN '(' DT_STRING ',' integer_prim ',' integer_prim ')'
@@ -333,6 +340,7 @@ propdata:
 
 			$$ = data_merge($1, d);
 			fclose(f);
+			data_free($4);
 		}
 	| propdataprefix DT_INCBIN '(' DT_STRING ')'
 		{
@@ -343,6 +351,7 @@ propdata:
 
 			$$ = data_merge($1, d);
 			fclose(f);
+			data_free($4);
 		}
 	| propdata DT_LABEL
 		{
@@ -384,12 +393,12 @@ arrayprefix:
 				bits = 32;
 			}
 
-			$$.data = data_add_marker(empty_data, type, NULL);
+			$$.builder = data_builder_start(type);
 			$$.bits = bits;
 		}
 	| '<'
 		{
-			$$.data = data_add_marker(empty_data, TYPE_UINT32, NULL);
+			$$.builder = data_builder_start(TYPE_UINT32);
 			$$.bits = 32;
 		}
 	| arrayprefix integer_prim
@@ -411,28 +420,32 @@ arrayprefix:
 						" truncated to 0x%0*" PRIx64 "\n",
 						loc, $2, $1.bits / 4, ($2 & mask));
 					free(loc);
+					treesource_warning = true;
 				}
 			}
 
-			$$.data = data_append_integer($1.data, $2, $1.bits);
+			$$.builder = data_builder_append_integer($1.builder,
+								 $2, $1.bits);
 		}
 	| arrayprefix dt_ref
 		{
 			uint64_t val = ~0ULL >> (64 - $1.bits);
 
 			if ($1.bits == 32)
-				$1.data = data_add_marker($1.data,
-							  REF_PHANDLE,
-							  $2);
+				$1.builder = data_builder_add_marker($1.builder,
+								     REF_PHANDLE,
+								     $2);
 			else
 				ERROR(&@2, "References are only allowed in "
 					    "arrays with 32-bit elements.");
 
-			$$.data = data_append_integer($1.data, val, $1.bits);
+			$$.builder = data_builder_append_integer($1.builder,
+								 val, $1.bits);
 		}
 	| arrayprefix DT_LABEL
 		{
-			$$.data = data_add_marker($1.data, LABEL, $2);
+			$$.builder = data_builder_add_marker($1.builder,
+							     LABEL, $2);
 		}
 	;
 
@@ -538,15 +551,15 @@ integer_unary:
 bytestring:
 	  /* empty */
 		{
-			$$ = data_add_marker(empty_data, TYPE_UINT8, NULL);
+			$$ = data_builder_start(TYPE_UINT8);
 		}
 	| bytestring DT_BYTE
 		{
-			$$ = data_append_byte($1, $2);
+			$$ = data_builder_append_integer($1, $2, 8);
 		}
 	| bytestring DT_LABEL
 		{
-			$$ = data_add_marker($1, LABEL, $2);
+			$$ = data_builder_add_marker($1, LABEL, $2);
 		}
 	;
 
@@ -3,7 +3,11 @@
  * (C) Copyright David Gibson <dwg@au1.ibm.com>, IBM Corporation.  2005.
  */
 
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "dtc.h"
 #include "srcpos.h"
@@ -22,6 +26,20 @@ int generate_fixups;		/* suppress generation of fixups on symbol support */
 int auto_label_aliases;		/* auto generate labels -> aliases */
 int annotate;		/* Level of annotation: 1 for input source location
 			   >1 for full input source location. */
+int pack_strings;	/* store names longest tail first */
+int jobs = 1;		/* Number of threads to run checks on */
+int check_stats;	/* Report time spent and work done by each check */
+int preprocess;		/* Preprocess dts input with the built-in cpp */
+const char *include_cache;	/* Keep parsed include files here */
+int keep_includes;	/* Reuse parsed include files for later inputs */
+static const char *time_report;	/* Format of the phase report, if any */
+
+/* How each input is compiled */
+static const char *cmdline_inform, *cmdline_outform;
+static const char *diffname;
+static bool force, sort, max_phandle;
+static int outversion = DEFAULT_FDT_VERSION;
+static long long cmdline_boot_cpuid = -1;
 
 static int is_power_of_2(int x)
 {
@@ -45,9 +63,19 @@ static void fill_fullpaths(struct node *tree, const char *prefix)
 		fill_fullpaths(child, tree->fullpath);
 }
 
+/* Options with no short form */
+enum {
+	OPT_CHECK_STATS = 0x100,
+	OPT_TIME_REPORT,
+	OPT_CPP,
+	OPT_DEFINE,
+	OPT_INCLUDE_CACHE,
+	OPT_BATCH,
+};
+
 /* Usage related data. */
-static const char usage_synopsis[] = "dtc [options] <input file>";
-static const char usage_short_opts[] = "qI:O:o:V:d:R:S:p:a:fb:i:H:sW:E:@AThv";
+static const char usage_synopsis[] = "dtc [options] <input file> [<overlay file>...]";
+static const char usage_short_opts[] = "qI:O:o:V:d:R:S:p:a:Pfb:i:H:sW:E:j:@AD:MThv";
 static struct option const usage_long_opts[] = {
 	{"quiet",            no_argument, NULL, 'q'},
 	{"in-format",         a_argument, NULL, 'I'},
@@ -59,6 +87,7 @@ static struct option const usage_long_opts[] = {
 	{"space",             a_argument, NULL, 'S'},
 	{"pad",               a_argument, NULL, 'p'},
 	{"align",             a_argument, NULL, 'a'},
+	{"pack-strings",     no_argument, NULL, 'P'},
 	{"boot-cpu",          a_argument, NULL, 'b'},
 	{"force",            no_argument, NULL, 'f'},
 	{"include",           a_argument, NULL, 'i'},
@@ -66,8 +95,17 @@ static struct option const usage_long_opts[] = {
 	{"phandle",           a_argument, NULL, 'H'},
 	{"warning",           a_argument, NULL, 'W'},
 	{"error",             a_argument, NULL, 'E'},
+	{"jobs",              a_argument, NULL, 'j'},
+	{"check-stats",      no_argument, NULL, OPT_CHECK_STATS},
+	{"time-report",       a_argument, NULL, OPT_TIME_REPORT},
+	{"cpp",              no_argument, NULL, OPT_CPP},
+	{"define",            a_argument, NULL, OPT_DEFINE},
+	{"include-cache",     a_argument, NULL, OPT_INCLUDE_CACHE},
+	{"batch",             a_argument, NULL, OPT_BATCH},
 	{"symbols",	     no_argument, NULL, '@'},
 	{"auto-alias",       no_argument, NULL, 'A'},
+	{"diff-from",         a_argument, NULL, 'D'},
+	{"max-phandle",      no_argument, NULL, 'M'},
 	{"annotate",         no_argument, NULL, 'T'},
 	{"help",             no_argument, NULL, 'h'},
 	{"version",          no_argument, NULL, 'v'},
@@ -93,6 +131,7 @@ static const char * const usage_opts_help[] = {
 	"\n\tMake the blob at least <bytes> long (extra space)",
 	"\n\tAdd padding to the blob of <bytes> long (extra space)",
 	"\n\tMake the blob align to the <bytes> (extra space)",
+	"\n\tShare the tails of property names in the strings block wherever possible (for dtb and asm output)",
 	"\n\tSet the physical boot cpu",
 	"\n\tTry to produce output even if the input tree has errors",
 	"\n\tAdd a path to search for include files",
@@ -103,8 +142,19 @@ static const char * const usage_opts_help[] = {
 	 "\t\tboth   - Both \"linux,phandle\" and \"phandle\" properties",
 	"\n\tEnable/disable warnings (prefix with \"no-\")",
 	"\n\tEnable/disable errors (prefix with \"no-\")",
+	"\n\tRun checks on <number> threads",
+	"\n\tReport the time taken and the nodes and properties visited by each check",
+	"\n\tReport the cost of each phase and the size of the tree, as:\n"
+	 "\t\ttext - a table\n"
+	 "\t\tjson - a JSON object",
+	"\n\tRun dts input through the built-in C preprocessor, instead of cpp beforehand",
+	"\n\tDefine <name>[=<value>] for the built-in preprocessor (implies --cpp)",
+	"\n\tKeep the trees parsed from #included files in <dir>, for later runs to reuse (implies --cpp)",
+	"\n\tCompile each \"<input> <output> [<dependency file>]\" line of <file>, -j of them at a time",
 	"\n\tEnable generation of symbols",
 	"\n\tEnable auto-alias of labels",
+	"\n\tOutput an overlay which turns the tree in <file> into the input tree",
+	"\n\tRecord the highest phandle in the root node, for libfdt to pick up",
 	"\n\tAnnotate output .dts with input source file and line (-T -T for more details)",
 	"\n\tPrint this help and exit",
 	"\n\tPrint version and exit",
@@ -159,19 +209,490 @@ static const char *guess_input_format(const char *fname, const char *fallback)
 	return guess_type_by_name(fname, fallback);
 }
 
+static struct dt_info *dt_from_file(const char *fname, const char *inform)
+{
+	if (streq(inform, "dts"))
+		return dt_from_source(fname);
+	else if (streq(inform, "fs"))
+		return dt_from_fs(fname);
+	else if(streq(inform, "dtb"))
+		return dt_from_blob(fname);
+	else
+		die("Unknown input format \"%s\"\n", inform);
+}
+
+/*
+ * --time-report: what each phase of the run cost, each measured from the
+ * end of the one before, and what the final tree is made of.
+ */
+#define MAX_PHASES	16
+
+struct phase_cost {
+	const char *name;
+	double wall, cpu;		/* seconds */
+	size_t allocs, alloc_bytes;	/* from the arena */
+	long peak_rss;			/* KiB, by the end of the phase */
+};
+
+static struct phase_cost phases[MAX_PHASES];
+static int num_phases;
+static struct phase_cost phase_last;
+
+struct tree_stats {
+	unsigned long nodes, props, labels, markers, value_bytes;
+};
+
+static void measure_phase(struct phase_cost *p)
+{
+	struct timespec ts;
+	struct rusage ru;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	p->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+
+	getrusage(RUSAGE_SELF, &ru);
+	p->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	p->peak_rss = ru.ru_maxrss;
+
+	arena_stats(&p->allocs, &p->alloc_bytes);
+}
+
+static void end_phase(const char *name)
+{
+	struct phase_cost now, *p;
+
+	if (!time_report)
+		return;
+
+	measure_phase(&now);
+	if (name && num_phases < MAX_PHASES) {
+		p = &phases[num_phases++];
+		p->name = name;
+		p->wall = now.wall - phase_last.wall;
+		p->cpu = now.cpu - phase_last.cpu;
+		p->allocs = now.allocs - phase_last.allocs;
+		p->alloc_bytes = now.alloc_bytes - phase_last.alloc_bytes;
+		p->peak_rss = now.peak_rss;
+	}
+	phase_last = now;
+}
+
+static void count_labels(struct label *labels, struct tree_stats *st)
+{
+	struct label *l;
+
+	for_each_label(labels, l)
+		st->labels++;
+}
+
+static void count_tree(struct node *node, struct tree_stats *st)
+{
+	struct property *prop;
+	struct node *child;
+	struct marker *m;
+
+	st->nodes++;
+	count_labels(node->labels, st);
+
+	for_each_property(node, prop) {
+		st->props++;
+		count_labels(prop->labels, st);
+		st->value_bytes += prop->val.len;
+		for (m = prop->val.markers; m; m = m->next)
+			st->markers++;
+	}
+
+	for_each_child(node, child)
+		count_tree(child, st);
+}
+
+static void print_time_report(struct dt_info *dti)
+{
+	struct tree_stats st = { 0 };
+	int i;
+
+	count_tree(dti->dt, &st);
+
+	if (streq(time_report, "json")) {
+		fprintf(stderr, "{\"phases\": [");
+		for (i = 0; i < num_phases; i++)
+			fprintf(stderr, "%s\n  {\"name\": \"%s\", \"wall_ms\": %.3f, "
+				"\"cpu_ms\": %.3f, \"arena_allocs\": %zu, "
+				"\"arena_bytes\": %zu, \"peak_rss_kib\": %ld}",
+				i ? "," : "", phases[i].name,
+				phases[i].wall * 1000, phases[i].cpu * 1000,
+				phases[i].allocs, phases[i].alloc_bytes,
+				phases[i].peak_rss);
+		fprintf(stderr, "\n ],\n \"tree\": {\"nodes\": %lu, "
+			"\"properties\": %lu, \"labels\": %lu, "
+			"\"markers\": %lu, \"value_bytes\": %lu}}\n",
+			st.nodes, st.props, st.labels, st.markers,
+			st.value_bytes);
+		return;
+	}
+
+	fprintf(stderr, "%-12s %10s %10s %12s %12s %14s\n", "phase",
+		"wall (ms)", "cpu (ms)", "arena allocs", "arena bytes",
+		"peak rss (KiB)");
+	for (i = 0; i < num_phases; i++)
+		fprintf(stderr, "%-12s %10.3f %10.3f %12zu %12zu %14ld\n",
+			phases[i].name, phases[i].wall * 1000,
+			phases[i].cpu * 1000, phases[i].allocs,
+			phases[i].alloc_bytes, phases[i].peak_rss);
+	fprintf(stderr, "tree: %lu nodes, %lu properties, %lu labels, "
+		"%lu markers, %lu value bytes\n", st.nodes, st.props,
+		st.labels, st.markers, st.value_bytes);
+}
+
+/*
+ * Check a tree other than the one being compiled: the base of a -D
+ * diff, or the overlay made from it.  They still have to pass, but
+ * don't get warnings or statistics of their own.
+ */
+static void process_side_checks(struct dt_info *dti)
+{
+	int stats = check_stats;
+
+	quiet++;
+	check_stats = 0;
+	process_checks(force, dti);
+	check_stats = stats;
+	quiet--;
+}
+
+static void compile(const char *arg, char *const *overlays, int noverlays,
+		    const char *outname, const char *depname)
+{
+	struct dt_info *dti, *old_dti = NULL, *new_dti;
+	const char *inform = cmdline_inform, *outform = cmdline_outform;
+	int symbols = generate_symbols, fixups = generate_fixups;
+	FILE *outf = NULL;
+	int i;
+
+	if (depname) {
+		depfile = fopen(depname, "w");
+		if (!depfile)
+			die("Couldn't open dependency file %s: %s\n", depname,
+			    strerror(errno));
+		fprintf(depfile, "%s:", outname);
+	}
+
+	if (inform == NULL)
+		inform = guess_input_format(arg, "dts");
+	if (outform == NULL) {
+		outform = guess_type_by_name(outname, NULL);
+		if (outform == NULL) {
+			if (streq(inform, "dts"))
+				outform = "dtb";
+			else
+				outform = "dts";
+		}
+	}
+	if (annotate && (!streq(inform, "dts") || !streq(outform, "dts")))
+		die("--annotate requires -I dts -O dts\n");
+
+	num_phases = 0;
+	end_phase(NULL);
+	reset_orphan_fragments();
+	dti = dt_from_file(arg, inform);
+	end_phase("parse");
+
+	if (noverlays && get_subnode(dti->dt, "__symbols__")) {
+		/* Carry the symbols of a compiled base tree over */
+		add_symbol_labels(dti->dt);
+		delete_node_by_name(dti->dt, "__symbols__");
+		generate_symbols = 1;
+	}
+
+	if (noverlays) {
+		for (i = 0; i < noverlays; i++)
+			merge_overlay(dti, dt_from_file(overlays[i],
+					guess_input_format(overlays[i], "dts")),
+				      overlays[i]);
+		end_phase("overlays");
+	}
+
+	if (diffname) {
+		old_dti = dt_from_file(diffname,
+				       guess_input_format(diffname, "dts"));
+		end_phase("parse-diff");
+	}
+
+	dti->outname = outname;
+
+	if (depfile) {
+		fputc('\n', depfile);
+		fclose(depfile);
+		depfile = NULL;
+	}
+
+	if (cmdline_boot_cpuid != -1)
+		dti->boot_cpuid_phys = cmdline_boot_cpuid;
+
+	fill_fullpaths(dti->dt, "");
+	end_phase("fullpaths");
+
+	/* on a plugin, generate by default */
+	if (dti->dtsflags & DTSF_PLUGIN) {
+		generate_fixups = 1;
+	}
+
+	process_checks(force, dti);
+	end_phase("checks");
+
+	/* From here on, nothing deleted can come back */
+	compact_tree(dti->dt);
+	end_phase("compact");
+
+	if (old_dti) {
+		fill_fullpaths(old_dti->dt, "");
+
+		/* The input tree has already been warned about */
+		process_side_checks(old_dti);
+		compact_tree(old_dti->dt);
+
+		/* Only the overlay itself may get a phandle hint */
+		delete_property_by_name(old_dti->dt, FDT_MAX_PHANDLE_HINT);
+		delete_property_by_name(dti->dt, FDT_MAX_PHANDLE_HINT);
+
+		/* Both trees get the phandles -@ would give them */
+		if (generate_symbols) {
+			generate_label_tree(old_dti, "__symbols__", true);
+			generate_label_tree(dti, "__symbols__", true);
+		}
+
+		new_dti = dti;
+		dti = dt_diff(old_dti, dti, force);
+		dti->outname = outname;
+		free_dt_info(old_dti);
+		free_dt_info(new_dti);
+
+		/* Skeleton nodes of the overlay lack their context */
+		fill_fullpaths(dti->dt, "");
+		generate_fixups = 1;
+		process_side_checks(dti);
+		end_phase("diff");
+	}
+
+	if (auto_label_aliases)
+		generate_label_tree(dti, "aliases", false);
+
+	if (generate_symbols)
+		generate_label_tree(dti, "__symbols__", true);
+
+	if (generate_fixups) {
+		generate_fixups_tree(dti, "__fixups__");
+		generate_local_fixups_tree(dti, "__local_fixups__");
+	}
+
+	/* A hint carried over from the input would be stale by now */
+	if (max_phandle || get_property(dti->dt, FDT_MAX_PHANDLE_HINT))
+		generate_max_phandle_hint(dti);
+	end_phase("generate");
+
+	if (sort) {
+		sort_tree(dti);
+		end_phase("sort");
+	}
+
+	if (streq(outname, "-")) {
+		outf = stdout;
+	} else {
+		outf = fopen(outname, "wb");
+		if (! outf)
+			die("Couldn't open output file %s: %s\n",
+			    outname, strerror(errno));
+	}
+
+	if (streq(outform, "dts")) {
+		dt_to_source(outf, dti);
+#ifndef NO_YAML
+	} else if (streq(outform, "yaml")) {
+		if (!streq(inform, "dts"))
+			die("YAML output format requires dts input format\n");
+		dt_to_yaml(outf, dti);
+#endif
+	} else if (streq(outform, "dtb")) {
+		dt_to_blob(outf, dti, outversion);
+	} else if (streq(outform, "asm")) {
+		dt_to_asm(outf, dti, outversion);
+	} else if (streq(outform, "null")) {
+		/* do nothing */
+	} else {
+		die("Unknown output format \"%s\"\n", outform);
+	}
+	if ((outf == stdout) ? fflush(outf) : fclose(outf))
+		die("Couldn't write output file %s: %s\n", outname,
+		    strerror(errno));
+	end_phase("output");
+
+	if (time_report)
+		print_time_report(dti);
+
+	/* Overlays and plugins only turn these on for their own output */
+	generate_symbols = symbols;
+	generate_fixups = fixups;
+
+	free_dt_info(dti);
+	treecache_reset();
+	arena_free_all();
+}
+
+/*
+ * --batch: compile many inputs in one go.  The parser can only work on
+ * one tree at a time in a process, so the inputs are shared out among
+ * -j worker processes, each compiling one after another.  Within a
+ * worker, files read by the preprocessor and the trees parsed from
+ * them stay around for the inputs which follow (see treecache.c).
+ */
+struct batch_job {
+	char *input, *output, *depname;
+};
+
+static struct batch_job *current_job;
+
+static struct batch_job *read_batch(const char *fname, int *njobs)
+{
+	struct batch_job *list = NULL;
+	char *line = NULL, *p, *fields[4];
+	size_t size = 0;
+	int lineno = 0, n;
+	FILE *f;
+
+	f = streq(fname, "-") ? stdin : fopen(fname, "r");
+	if (!f)
+		die("Couldn't open batch file %s: %s\n", fname,
+		    strerror(errno));
+
+	*njobs = 0;
+	while (getline(&line, &size, f) >= 0) {
+		lineno++;
+		n = 0;
+		for (p = strtok(line, " \t\r\n"); p && (n < 4);
+		     p = strtok(NULL, " \t\r\n"))
+			fields[n++] = p;
+		if (!n || (fields[0][0] == '#'))
+			continue;
+		if ((n < 2) || (n > 3))
+			die("%s:%d: Expected \"<input> <output> [<dependency file>]\"\n",
+			    fname, lineno);
+
+		list = xrealloc(list, (*njobs + 1) * sizeof(*list));
+		list[*njobs].input = xstrdup(fields[0]);
+		list[*njobs].output = xstrdup(fields[1]);
+		list[*njobs].depname = (n > 2) ? xstrdup(fields[2]) : NULL;
+		(*njobs)++;
+	}
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	return list;
+}
+
+static void report_failed_job(void)
+{
+	if (current_job)
+		fprintf(stderr, "ERROR: Couldn't compile %s\n",
+			current_job->input);
+}
+
+/*
+ * The workers take turns at the pipe, which holds the number of the
+ * next job: read it, put back the one after, then compile.  So the
+ * pipe never fills, and a worker which dies takes no more than its job
+ * down with it.
+ */
+static void batch_worker(struct batch_job *list, int njobs, int fd[2])
+{
+	uint32_t i, next;
+
+	atexit(report_failed_job);
+	for (;;) {
+		if (read(fd[0], &i, sizeof(i)) != sizeof(i))
+			die("Couldn't take a batch job: %s\n", strerror(errno));
+		next = (i < (uint32_t)njobs) ? i + 1 : i;
+		if (write(fd[1], &next, sizeof(next)) != sizeof(next))
+			die("Couldn't pass batch jobs on: %s\n",
+			    strerror(errno));
+		if (i == next)
+			break;
+
+		current_job = &list[i];
+		compile(list[i].input, NULL, 0, list[i].output,
+			list[i].depname);
+		current_job = NULL;
+	}
+	exit(0);
+}
+
+static void start_worker(struct batch_job *list, int njobs, int fd[2])
+{
+	pid_t pid;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		die("Couldn't start batch worker: %s\n", strerror(errno));
+	if (!pid)
+		batch_worker(list, njobs, fd);
+}
+
+static int run_batch(const char *fname, int workers)
+{
+	struct batch_job *list;
+	int njobs, running, status, i, ret = 0;
+	int fd[2];
+	uint32_t first = 0;
+
+	list = read_batch(fname, &njobs);
+	if (workers > njobs)
+		workers = njobs;
+
+	if (pipe(fd))
+		die("Couldn't create pipe: %s\n", strerror(errno));
+	if (write(fd[1], &first, sizeof(first)) != sizeof(first))
+		die("Couldn't queue batch jobs: %s\n", strerror(errno));
+	for (running = 0; running < workers; running++)
+		start_worker(list, njobs, fd);
+
+	while (running) {
+		if (wait(&status) < 0)
+			die("Couldn't wait for batch worker: %s\n",
+			    strerror(errno));
+		running--;
+		if (WIFEXITED(status) && !WEXITSTATUS(status))
+			continue;
+
+		/* It took a job down with it, but not the rest */
+		if (WIFEXITED(status) && (WEXITSTATUS(status) > ret))
+			ret = WEXITSTATUS(status);
+		else if (!WIFEXITED(status))
+			ret = (ret > 1) ? ret : 1;
+		start_worker(list, njobs, fd);
+		running++;
+	}
+	close(fd[0]);
+	close(fd[1]);
+
+	for (i = 0; i < njobs; i++) {
+		free(list[i].input);
+		free(list[i].output);
+		free(list[i].depname);
+	}
+	free(list);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
-	struct dt_info *dti;
-	const char *inform = NULL;
-	const char *outform = NULL;
 	const char *outname = "-";
 	const char *depname = NULL;
-	bool force = false, sort = false;
+	const char *batch = NULL;
 	const char *arg;
-	int opt;
-	FILE *outf = NULL;
-	int outversion = DEFAULT_FDT_VERSION;
-	long long cmdline_boot_cpuid = -1;
+	int opt, workers;
 
 	quiet      = 0;
 	reservenum = 0;
@@ -182,10 +703,10 @@ int main(int argc, char *argv[])
 	while ((opt = util_getopt_long()) != EOF) {
 		switch (opt) {
 		case 'I':
-			inform = optarg;
+			cmdline_inform = optarg;
 			break;
 		case 'O':
-			outform = optarg;
+			cmdline_outform = optarg;
 			break;
 		case 'o':
 			outname = optarg;
@@ -211,6 +732,9 @@ int main(int argc, char *argv[])
 				die("Invalid argument \"%d\" to -a option\n",
 				    alignsize);
 			break;
+		case 'P':
+			pack_strings = 1;
+			break;
 		case 'f':
 			force = true;
 			break;
@@ -249,12 +773,54 @@ int main(int argc, char *argv[])
 			parse_checks_option(false, true, optarg);
 			break;
 
+		case OPT_CHECK_STATS:
+			check_stats = 1;
+			break;
+
+		case OPT_TIME_REPORT:
+			if (!streq(optarg, "text") && !streq(optarg, "json"))
+				die("Invalid argument \"%s\" to --time-report option\n",
+				    optarg);
+			time_report = optarg;
+			break;
+
+		case OPT_CPP:
+			preprocess = 1;
+			break;
+
+		case OPT_DEFINE:
+			cpp_define(optarg);
+			preprocess = 1;
+			break;
+
+		case OPT_INCLUDE_CACHE:
+			include_cache = optarg;
+			preprocess = 1;
+			break;
+
+		case OPT_BATCH:
+			batch = optarg;
+			break;
+
+		case 'j':
+			jobs = strtol(optarg, NULL, 0);
+			if (jobs < 1)
+				die("Invalid argument \"%d\" to -j option\n",
+				    jobs);
+			break;
+
 		case '@':
 			generate_symbols = 1;
 			break;
 		case 'A':
 			auto_label_aliases = 1;
 			break;
+		case 'D':
+			diffname = optarg;
+			break;
+		case 'M':
+			max_phandle = true;
+			break;
 		case 'T':
 			annotate++;
 			break;
@@ -266,106 +832,27 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (argc > (optind+1))
-		usage("missing files");
-	else if (argc < (optind+1))
-		arg = "-";
-	else
-		arg = argv[optind];
-
 	/* minsize and padsize are mutually exclusive */
 	if (minsize && padsize)
 		die("Can't set both -p and -S\n");
 
-	if (depname) {
-		depfile = fopen(depname, "w");
-		if (!depfile)
-			die("Couldn't open dependency file %s: %s\n", depname,
-			    strerror(errno));
-		fprintf(depfile, "%s:", outname);
+	if (batch) {
+		if ((argc > optind) || depname || !streq(outname, "-"))
+			die("--batch takes inputs and outputs from %s\n",
+			    batch);
+		/* -j is for the workers, not the checks of each */
+		workers = jobs;
+		jobs = 1;
+		keep_includes = 1;
+		exit(run_batch(batch, workers));
 	}
 
-	if (inform == NULL)
-		inform = guess_input_format(arg, "dts");
-	if (outform == NULL) {
-		outform = guess_type_by_name(outname, NULL);
-		if (outform == NULL) {
-			if (streq(inform, "dts"))
-				outform = "dtb";
-			else
-				outform = "dts";
-		}
-	}
-	if (annotate && (!streq(inform, "dts") || !streq(outform, "dts")))
-		die("--annotate requires -I dts -O dts\n");
-	if (streq(inform, "dts"))
-		dti = dt_from_source(arg);
-	else if (streq(inform, "fs"))
-		dti = dt_from_fs(arg);
-	else if(streq(inform, "dtb"))
-		dti = dt_from_blob(arg);
+	if (argc < (optind+1))
+		arg = "-";
 	else
-		die("Unknown input format \"%s\"\n", inform);
-
-	dti->outname = outname;
-
-	if (depfile) {
-		fputc('\n', depfile);
-		fclose(depfile);
-	}
-
-	if (cmdline_boot_cpuid != -1)
-		dti->boot_cpuid_phys = cmdline_boot_cpuid;
-
-	fill_fullpaths(dti->dt, "");
-
-	/* on a plugin, generate by default */
-	if (dti->dtsflags & DTSF_PLUGIN) {
-		generate_fixups = 1;
-	}
-
-	process_checks(force, dti);
-
-	if (auto_label_aliases)
-		generate_label_tree(dti, "aliases", false);
-
-	if (generate_symbols)
-		generate_label_tree(dti, "__symbols__", true);
-
-	if (generate_fixups) {
-		generate_fixups_tree(dti, "__fixups__");
-		generate_local_fixups_tree(dti, "__local_fixups__");
-	}
-
-	if (sort)
-		sort_tree(dti);
-
-	if (streq(outname, "-")) {
-		outf = stdout;
-	} else {
-		outf = fopen(outname, "wb");
-		if (! outf)
-			die("Couldn't open output file %s: %s\n",
-			    outname, strerror(errno));
-	}
-
-	if (streq(outform, "dts")) {
-		dt_to_source(outf, dti);
-#ifndef NO_YAML
-	} else if (streq(outform, "yaml")) {
-		if (!streq(inform, "dts"))
-			die("YAML output format requires dts input format\n");
-		dt_to_yaml(outf, dti);
-#endif
-	} else if (streq(outform, "dtb")) {
-		dt_to_blob(outf, dti, outversion);
-	} else if (streq(outform, "asm")) {
-		dt_to_asm(outf, dti, outversion);
-	} else if (streq(outform, "null")) {
-		/* do nothing */
-	} else {
-		die("Unknown output format \"%s\"\n", outform);
-	}
+		arg = argv[optind];
 
+	compile(arg, argv + optind + 1,
+		(argc > (optind+1)) ? argc - (optind+1) : 0, outname, depname);
 	exit(0);
 }
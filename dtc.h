@@ -44,6 +44,12 @@ extern int generate_symbols;	/* generate symbols for nodes with labels */
 extern int generate_fixups;	/* generate fixups */
 extern int auto_label_aliases;	/* auto generate labels -> aliases */
 extern int annotate;		/* annotate .dts with input source location */
+extern int pack_strings;	/* share name tails in the strings block */
+extern int jobs;		/* threads to run checks on */
+extern int check_stats;		/* report the cost of each check */
+extern int preprocess;		/* run the built-in preprocessor on input */
+extern const char *include_cache; /* directory of parsed include files */
+extern int keep_includes;	/* reuse parsed include files for later inputs */
 
 #define PHANDLE_LEGACY	0x1
 #define PHANDLE_EPAPR	0x2
@@ -133,10 +139,21 @@ struct  marker {
 
 struct data {
 	unsigned int len;
+	unsigned int size;	/* allocated length of val */
 	char *val;
 	struct marker *markers;
 };
 
+/*
+ * A value under construction one element at a time, as the parser
+ * builds <...> and [...]: keeping hold of the last marker saves a walk
+ * of the marker list on every addition.
+ */
+struct data_builder {
+	struct data data;
+	struct marker *last;
+};
+
 
 #define empty_data ((struct data){ 0 /* all .members = 0 or NULL */ })
 
@@ -174,6 +191,9 @@ struct data data_copy_file(FILE *f, size_t len);
 struct data data_append_data(struct data d, const void *p, int len);
 struct data data_insert_at_marker(struct data d, struct marker *m,
 				  const void *p, int len);
+typedef const void *(*marker_value_fn)(struct marker *m, int *len, void *arg);
+struct data data_insert_at_markers(struct data d, enum markertype type,
+				   marker_value_fn fn, void *arg);
 struct data data_merge(struct data d1, struct data d2);
 struct data data_append_cell(struct data d, cell_t word);
 struct data data_append_integer(struct data d, uint64_t word, int bits);
@@ -185,6 +205,12 @@ struct data data_append_align(struct data d, int align);
 
 struct data data_add_marker(struct data d, enum markertype type, char *ref);
 
+struct data_builder data_builder_start(enum markertype type);
+struct data_builder data_builder_append_integer(struct data_builder b,
+						uint64_t value, int bits);
+struct data_builder data_builder_add_marker(struct data_builder b,
+					    enum markertype type, char *ref);
+
 bool data_is_one_string(struct data d);
 
 /* DT constraints */
@@ -234,6 +260,13 @@ struct node {
 	struct srcpos *srcpos;
 
 	bool omit_if_unused, is_referenced;
+
+	uint64_t hash;
+	struct label_table *labeltab;	/* label index, for a root */
+	struct phandle_table *phandletab;	/* phandle index, for a root */
+	struct name_index *propindex, *childindex;	/* for wide nodes */
+	struct node *irqanchor;		/* interrupt parent index */
+	unsigned int irqgeneration;	/* of the above, for a root */
 };
 
 #define for_each_label_withdel(l0, l) \
@@ -258,6 +291,7 @@ struct node {
 		if (!(c)->deleted)
 
 void add_label(struct label **labels, char *label);
+void add_node_label(struct node *node, char *label);
 void delete_labels(struct label **labels);
 
 struct property *build_property(char *name, struct data val,
@@ -275,10 +309,11 @@ struct node *reference_node(struct node *node);
 struct node *chain_node(struct node *first, struct node *list);
 struct node *merge_nodes(struct node *old_node, struct node *new_node);
 struct node *add_orphan_node(struct node *old_node, struct node *new_node, char *ref);
+void reset_orphan_fragments(void);
 
 void add_property(struct node *node, struct property *prop);
 void delete_property_by_name(struct node *node, char *name);
-void delete_property(struct property *prop);
+void delete_property(struct node *node, struct property *prop);
 void add_child(struct node *parent, struct node *child);
 void delete_node_by_name(struct node *parent, char *name);
 void delete_node(struct node *node);
@@ -299,7 +334,12 @@ struct node *get_node_by_path(struct node *tree, const char *path);
 struct node *get_node_by_label(struct node *tree, const char *label);
 struct node *get_node_by_phandle(struct node *tree, cell_t phandle);
 struct node *get_node_by_ref(struct node *tree, const char *ref);
+void set_node_phandle(struct node *root, struct node *node, cell_t phandle);
+void index_tree(struct node *tree);
+bool node_is_interrupt_provider(struct node *node);
+struct node *get_interrupt_parent_source(struct node *tree, struct node *node);
 cell_t get_node_phandle(struct node *root, struct node *node);
+cell_t get_max_phandle(struct node *tree);
 
 uint32_t guess_boot_cpuid(struct node *tree);
 
@@ -335,10 +375,18 @@ struct dt_info {
 struct dt_info *build_dt_info(unsigned int dtsflags,
 			      struct reserve_info *reservelist,
 			      struct node *tree, uint32_t boot_cpuid_phys);
+void free_node(struct node *node);
+void free_property(struct property *prop);
+void free_dt_info(struct dt_info *dti);
 void sort_tree(struct dt_info *dti);
+void compact_tree(struct node *tree);
 void generate_label_tree(struct dt_info *dti, char *name, bool allocph);
 void generate_fixups_tree(struct dt_info *dti, char *name);
 void generate_local_fixups_tree(struct dt_info *dti, char *name);
+void generate_max_phandle_hint(struct dt_info *dti);
+void add_symbol_labels(struct node *dt);
+void merge_overlay(struct dt_info *dti, struct dt_info *overlay,
+		   const char *name);
 
 /* Checks */
 
@@ -352,15 +400,33 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version);
 
 struct dt_info *dt_from_blob(const char *fname);
 
+/* Preprocessor */
+
+void cpp_define(const char *def);
+char *cpp_preprocess(FILE *f, const char *fname, size_t *len);
+
+/* Parsed include cache */
+
+#define TREECACHE_UNIT	"<include-cache>"	/* file of placeholder lines */
+
+int treecache_unit(const char *text, size_t len);
+struct node *treecache_merge(struct node *dt, struct node *node);
+void treecache_reset(void);
+
 /* Tree source */
 
 void dt_to_source(FILE *f, struct dt_info *dti);
 struct dt_info *dt_from_source(const char *f);
+bool dt_from_text(char *text, size_t len, const char *name);
 
 /* YAML source */
 
 void dt_to_yaml(FILE *f, struct dt_info *dti);
 
+/* Tree differences */
+
+struct dt_info *dt_diff(struct dt_info *old, struct dt_info *new, bool force);
+
 /* FS trees */
 
 struct dt_info *dt_from_fs(const char *dirname);
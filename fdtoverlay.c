@@ -24,18 +24,21 @@
 static const char usage_synopsis[] =
 	"apply a number of overlays to a base blob\n"
 	"	fdtoverlay <options> [<overlay.dtbo> [<overlay.dtbo>]]\n"
+	"	fdtoverlay -r <options> <overlay.dtbo>\n"
 	"\n"
 	USAGE_TYPE_MSG;
-static const char usage_short_opts[] = "i:o:v" USAGE_COMMON_SHORT_OPTS;
+static const char usage_short_opts[] = "i:o:rv" USAGE_COMMON_SHORT_OPTS;
 static struct option const usage_long_opts[] = {
 	{"input",            required_argument, NULL, 'i'},
 	{"output",	     required_argument, NULL, 'o'},
+	{"resolve",	           no_argument, NULL, 'r'},
 	{"verbose",	           no_argument, NULL, 'v'},
 	USAGE_COMMON_LONG_OPTS,
 };
 static const char * const usage_opts_help[] = {
 	"Input base DT blob",
 	"Output DT blob",
+	"Resolve the overlay against the base blob instead of applying it",
 	"Verbose messages",
 	USAGE_COMMON_OPTS_HELP
 };
@@ -90,6 +93,59 @@ fail:
 
 	return NULL;
 }
+
+static int do_resolve(const char *input_filename,
+		      const char *output_filename, const char *name)
+{
+	char *blob, *ovblob, *tmp = NULL;
+	size_t buf_len;
+	int ret = -1;
+
+	blob = utilfdt_read(input_filename, NULL);
+	if (!blob) {
+		fprintf(stderr, "\nFailed to read '%s'\n", input_filename);
+		return -1;
+	}
+
+	ovblob = utilfdt_read(name, NULL);
+	if (!ovblob) {
+		fprintf(stderr, "\nFailed to read '%s'\n", name);
+		goto out_err;
+	}
+
+	/* a failed resolve can trash the overlay, so work on a copy */
+	buf_len = fdt_totalsize(ovblob);
+	do {
+		buf_len += BUF_INCREMENT;
+		tmp = xrealloc(tmp, buf_len);
+		ret = fdt_open_into(ovblob, tmp, buf_len);
+		if (ret)
+			break;
+
+		ret = fdt_overlay_resolve(blob, tmp);
+	} while (ret == -FDT_ERR_NOSPACE);
+
+	if (ret) {
+		fprintf(stderr, "\nFailed to resolve '%s': %s\n",
+			name, fdt_strerror(ret));
+		ret = -1;
+		goto out_err;
+	}
+
+	fdt_pack(tmp);
+	ret = utilfdt_write(output_filename, tmp);
+	if (ret)
+		fprintf(stderr, "\nFailed to write '%s'\n",
+			output_filename);
+
+out_err:
+	free(tmp);
+	free(ovblob);
+	free(blob);
+
+	return ret;
+}
+
 static int do_fdtoverlay(const char *input_filename,
 			 const char *output_filename,
 			 int argc, char *argv[])
@@ -163,6 +219,7 @@ out_err:
 int main(int argc, char *argv[])
 {
 	int opt, i;
+	bool resolve = false;
 	char *input_filename = NULL;
 	char *output_filename = NULL;
 
@@ -176,6 +233,9 @@ int main(int argc, char *argv[])
 		case 'o':
 			output_filename = optarg;
 			break;
+		case 'r':
+			resolve = true;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -194,6 +254,9 @@ int main(int argc, char *argv[])
 	if (argc <= 0)
 		usage("missing overlay file(s)");
 
+	if (resolve && argc != 1)
+		usage("--resolve takes exactly one overlay file");
+
 	if (verbose) {
 		printf("input  = %s\n", input_filename);
 		printf("output = %s\n", output_filename);
@@ -201,8 +264,13 @@ int main(int argc, char *argv[])
 			printf("overlay[%d] = %s\n", i, argv[i]);
 	}
 
-	if (do_fdtoverlay(input_filename, output_filename, argc, argv))
+	if (resolve) {
+		if (do_resolve(input_filename, output_filename, argv[0]))
+			return 1;
+	} else if (do_fdtoverlay(input_filename, output_filename,
+				 argc, argv)) {
 		return 1;
+	}
 
 	return 0;
 }
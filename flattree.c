@@ -218,23 +218,140 @@ static struct emitter asm_emitter = {
 	.property = asm_emit_property,
 };
 
-static int stringtable_insert(struct data *d, const char *str)
+/*
+ * The strings block.  A name is stored once and may also be found as
+ * the tail of a longer name stored before it ("phandle" within
+ * "linux,phandle"), so every tail of each stored string is hashed to
+ * its first offset.
+ */
+struct stringtable {
+	struct data data;
+	unsigned int *slots;	/* offset + 1, 0 for a free slot */
+	unsigned int nslots, count;
+};
+
+static unsigned int *stringtable_slot(struct stringtable *t, const char *str)
 {
-	unsigned int i;
+	unsigned int i = str_hash(str, strlen(str)) & (t->nslots - 1);
+
+	while (t->slots[i] && !streq(t->data.val + t->slots[i] - 1, str))
+		i = (i + 1) & (t->nslots - 1);
+
+	return &t->slots[i];
+}
+
+static void stringtable_grow(struct stringtable *t)
+{
+	unsigned int *old = t->slots, n = t->nslots, i;
+
+	t->nslots = n ? n * 2 : 256;
+	t->slots = xmalloc(t->nslots * sizeof(*t->slots));
+	memset(t->slots, 0, t->nslots * sizeof(*t->slots));
+
+	for (i = 0; i < n; i++)
+		if (old[i])
+			*stringtable_slot(t, t->data.val + old[i] - 1) = old[i];
+	free(old);
+}
 
-	/* FIXME: do this more efficiently? */
+static int stringtable_insert(struct stringtable *t, const char *str)
+{
+	unsigned int *slot, off, len = strlen(str), i;
+
+	if ((t->count + len + 1) * 2 > t->nslots)
+		stringtable_grow(t);
+
+	slot = stringtable_slot(t, str);
+	if (*slot)
+		return *slot - 1;
+
+	off = t->data.len;
+	t->data = data_append_data(t->data, str, len + 1);
 
-	for (i = 0; i < d->len; i++) {
-		if (streq(str, d->val + i))
-			return i;
+	for (i = 0; i <= len; i++) {
+		slot = stringtable_slot(t, t->data.val + off + i);
+		if (!*slot) {
+			*slot = off + i + 1;
+			t->count++;
+		}
 	}
 
-	*d = data_append_data(*d, str, strlen(str)+1);
-	return i;
+	return off;
+}
+
+/* The names flatten_tree() will ask for, as an array of pointers */
+static struct data collect_names(struct data names, struct node *tree,
+				 struct version_info *vi)
+{
+	static const char *name_prop = "name";
+	struct property *prop;
+	struct node *child;
+	bool seen_name_prop = false;
+
+	if (tree->deleted)
+		return names;
+
+	for_each_property(tree, prop) {
+		if (streq(prop->name, "name"))
+			seen_name_prop = true;
+		names = data_append_data(names, &prop->name,
+					 sizeof(prop->name));
+	}
+
+	if ((vi->flags & FTF_NAMEPROPS) && !seen_name_prop)
+		names = data_append_data(names, &name_prop, sizeof(name_prop));
+
+	for_each_child(tree, child)
+		names = collect_names(names, child, vi);
+
+	return names;
+}
+
+/* Descending order of the reversed strings */
+static int cmp_tails(const void *ax, const void *bx)
+{
+	const char *a = *(const char * const *)ax;
+	const char *b = *(const char * const *)bx;
+	size_t i = strlen(a), j = strlen(b);
+
+	while (i && j) {
+		unsigned char ca = a[--i], cb = b[--j];
+
+		if (ca != cb)
+			return (int)cb - (int)ca;
+	}
+
+	return (int)j - (int)i;
+}
+
+/*
+ * With pack_strings, store the names longest tail first, so that every
+ * name which ends another one shares its storage, whatever the order
+ * the properties come in.
+ */
+static void stringtable_init(struct stringtable *t, struct node *tree,
+			     struct version_info *vi)
+{
+	struct data names;
+	const char **name;
+	unsigned int n, i;
+
+	memset(t, 0, sizeof(*t));
+	if (!pack_strings)
+		return;
+
+	names = collect_names(empty_data, tree, vi);
+	name = (const char **)names.val;
+	n = names.len / sizeof(*name);
+
+	qsort(name, n, sizeof(*name), cmp_tails);
+	for (i = 0; i < n; i++)
+		stringtable_insert(t, name[i]);
+	data_free(names);
 }
 
 static void flatten_tree(struct node *tree, struct emitter *emit,
-			 void *etarget, struct data *strbuf,
+			 void *etarget, struct stringtable *strbuf,
 			 struct version_info *vi)
 {
 	struct property *prop;
@@ -350,7 +467,7 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	struct data blob       = empty_data;
 	struct data reservebuf = empty_data;
 	struct data dtbuf      = empty_data;
-	struct data strbuf     = empty_data;
+	struct stringtable strbuf;
 	struct fdt_header fdt;
 	int padlen = 0;
 
@@ -361,13 +478,15 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	if (!vi)
 		die("Unknown device tree blob version %d\n", version);
 
+	stringtable_init(&strbuf, dti->dt, vi);
 	flatten_tree(dti->dt, &bin_emitter, &dtbuf, &strbuf, vi);
 	bin_emit_cell(&dtbuf, FDT_END);
+	free(strbuf.slots);
 
 	reservebuf = flatten_reserve_list(dti->reservelist, vi);
 
 	/* Make header */
-	make_fdt_header(&fdt, vi, reservebuf.len, dtbuf.len, strbuf.len,
+	make_fdt_header(&fdt, vi, reservebuf.len, dtbuf.len, strbuf.data.len,
 			dti->boot_cpuid_phys);
 
 	/*
@@ -407,7 +526,7 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	blob = data_merge(blob, reservebuf);
 	blob = data_append_zeroes(blob, sizeof(struct fdt_reserve_entry));
 	blob = data_merge(blob, dtbuf);
-	blob = data_merge(blob, strbuf);
+	blob = data_merge(blob, strbuf.data);
 
 	/*
 	 * If the user asked for more space than is used, pad out the blob.
@@ -448,7 +567,7 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 {
 	struct version_info *vi = NULL;
 	unsigned int i;
-	struct data strbuf = empty_data;
+	struct stringtable strbuf;
 	struct reserve_info *re;
 	const char *symprefix = "dt";
 
@@ -534,14 +653,16 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 	fprintf(f, "\t.long\t0, 0\n\t.long\t0, 0\n");
 
 	emit_label(f, symprefix, "struct_start");
+	stringtable_init(&strbuf, dti->dt, vi);
 	flatten_tree(dti->dt, &asm_emitter, f, &strbuf, vi);
+	free(strbuf.slots);
 
 	fprintf(f, "\t/* FDT_END */\n");
 	asm_emit_cell(f, FDT_END);
 	emit_label(f, symprefix, "struct_end");
 
 	emit_label(f, symprefix, "strings_start");
-	dump_stringtable_asm(f, strbuf);
+	dump_stringtable_asm(f, strbuf.data);
 	emit_label(f, symprefix, "strings_end");
 
 	emit_label(f, symprefix, "blob_end");
@@ -560,7 +681,7 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 		asm_emit_align(f, alignsize);
 	emit_label(f, symprefix, "blob_abs_end");
 
-	data_free(strbuf);
+	data_free(strbuf.data);
 }
 
 struct inbuf {
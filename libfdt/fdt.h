@@ -63,4 +63,7 @@ struct fdt_property {
 #define FDT_V16_SIZE	FDT_V3_SIZE
 #define FDT_V17_SIZE	(FDT_V16_SIZE + sizeof(fdt32_t))
 
+/* Optional root property caching the highest phandle in the tree */
+#define FDT_MAX_PHANDLE_HINT	"__max_phandle__"
+
 #endif /* FDT_H */
@@ -350,7 +350,7 @@ static int overlay_update_local_references(void *fdto, uint32_t delta)
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_one_phandle(void *fdt, void *fdto,
+static int overlay_fixup_one_phandle(const void *fdt, void *fdto,
 				     int symbols_off,
 				     const char *path, uint32_t path_len,
 				     const char *name, uint32_t name_len,
@@ -410,8 +410,8 @@ static int overlay_fixup_one_phandle(void *fdt, void *fdto,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_phandle(void *fdt, void *fdto, int symbols_off,
-				 int property)
+static int overlay_fixup_phandle(const void *fdt, void *fdto,
+				 int symbols_off, int property)
 {
 	const char *value;
 	const char *label;
@@ -492,7 +492,7 @@ static int overlay_fixup_phandle(void *fdt, void *fdto, int symbols_off,
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_fixup_phandles(void *fdt, void *fdto)
+static int overlay_fixup_phandles(const void *fdt, void *fdto)
 {
 	int fixups_off, symbols_off;
 	int property;
@@ -661,13 +661,346 @@ static int get_path_len(const void *fdt, int nodeoffset)
 	return len;
 }
 
+/**
+ * struct overlay_target - Target of the fragment of an overlay symbol
+ * @fragment: node offset of the fragment in the overlay, -1 if unknown
+ * @target: node offset of the target in the base device tree
+ * @len: length of the target path
+ * @path: target path, if known (not \0 terminated)
+ *
+ * Symbols of the same fragment usually follow each other, so
+ * overlay_symbol_path() remembers the last target it looked up. It is
+ * only valid as long as neither blob is modified.
+ */
+struct overlay_target {
+	int fragment;
+	int target;
+	int len;
+	const char *path;
+};
+
+/**
+ * overlay_symbol_path - Compute the base tree path of an overlay symbol
+ * @fdt: Base Device Tree blob
+ * @fdto: Device tree overlay blob
+ * @prop: Property offset of the symbol in the overlay __symbols__ node
+ * @cache: last looked up target, or NULL
+ * @buf: buffer receiving the path, or NULL to only compute its length
+ * @buflen: size of @buf
+ *
+ * overlay_symbol_path() translates the path of an overlay symbol,
+ * which is of the form /<fragment-name>/__overlay__/<relative-path>,
+ * into the path the symbol will have in the base tree once the
+ * fragment has been merged into its target.
+ *
+ * returns:
+ *      the length of the path including its terminating \0
+ *      0, if the symbol refers to something that won't end up in the
+ *		target tree
+ *      Negative error code on failure
+ */
+static int overlay_symbol_path(const void *fdt, const void *fdto, int prop,
+			       struct overlay_target *cache,
+			       char *buf, int buflen)
+{
+	struct overlay_target t;
+	int path_len, len, frag_name_len, ret, rel_path_len;
+	const char *s, *e;
+	const char *path;
+	const char *frag_name;
+	const char *rel_path;
+	const char *target_path;
+
+	path = fdt_getprop_by_offset(fdto, prop, NULL, &path_len);
+	if (!path)
+		return path_len;
+
+	/* verify it's a string property (terminated by a single \0) */
+	if (path_len < 1 || memchr(path, '\0', path_len) != &path[path_len - 1])
+		return -FDT_ERR_BADVALUE;
+
+	/* keep end marker to avoid strlen() */
+	e = path + path_len;
+
+	if (*path != '/')
+		return -FDT_ERR_BADVALUE;
+
+	/* get fragment name first */
+	s = strchr(path + 1, '/');
+	if (!s) {
+		/* Symbol refers to something that won't end
+		 * up in the target tree */
+		return 0;
+	}
+
+	frag_name = path + 1;
+	frag_name_len = s - path - 1;
+
+	/* verify format; safe since "s" lies in \0 terminated prop */
+	len = sizeof("/__overlay__/") - 1;
+	if ((e - s) > len && (memcmp(s, "/__overlay__/", len) == 0)) {
+		/* /<fragment-name>/__overlay__/<relative-subnode-path> */
+		rel_path = s + len;
+		rel_path_len = e - rel_path - 1;
+	} else if ((e - s) == len
+		   && (memcmp(s, "/__overlay__", len - 1) == 0)) {
+		/* /<fragment-name>/__overlay__ */
+		rel_path = "";
+		rel_path_len = 0;
+	} else {
+		/* Symbol refers to something that won't end
+		 * up in the target tree */
+		return 0;
+	}
+
+	/* find the fragment index in which the symbol lies */
+	ret = fdt_subnode_offset_namelen(fdto, 0, frag_name,
+				       frag_name_len);
+	/* not found? */
+	if (ret < 0)
+		return -FDT_ERR_BADOVERLAY;
+	t.fragment = ret;
+
+	if (cache && cache->fragment == t.fragment) {
+		t = *cache;
+	} else {
+		/* an __overlay__ subnode must exist */
+		ret = fdt_subnode_offset(fdto, t.fragment, "__overlay__");
+		if (ret < 0)
+			return -FDT_ERR_BADOVERLAY;
+
+		/* get the target of the fragment */
+		ret = fdt_overlay_target_offset(fdt, fdto, t.fragment,
+						&target_path);
+		if (ret < 0)
+			return ret;
+		t.target = ret;
+
+		/* if we have a target path use */
+		if (!target_path) {
+			ret = get_path_len(fdt, t.target);
+			if (ret < 0)
+				return ret;
+			t.len = ret;
+		} else {
+			t.len = strlen(target_path);
+		}
+		t.path = target_path;
+	}
+
+	ret = t.len + (t.len > 1) + rel_path_len + 1;
+	if (!buf)
+		goto out;
+	if (buflen < ret)
+		return -FDT_ERR_INTERNAL;
+
+	len = t.len;
+	if (len > 1) { /* target is not root */
+		if (!t.path) {
+			int err = fdt_get_path(fdt, t.target, buf, len + 1);
+
+			if (err < 0)
+				return err;
+			t.path = buf;
+		} else if (t.path != buf) {
+			memcpy(buf, t.path, len);
+		}
+	} else
+		len--;
+
+	buf[len] = '/';
+	memcpy(buf + len + 1, rel_path, rel_path_len);
+	buf[len + 1 + rel_path_len] = '\0';
+
+out:
+	if (cache)
+		*cache = t;
+
+	return ret;
+}
+
+/**
+ * overlay_symbol_value - Get the value of a symbol to add to a base tree
+ * @fdt: Base Device Tree blob
+ * @fdto: Device tree overlay blob
+ * @prop: Property offset of the symbol in the overlay
+ * @copy: whether the symbol already holds its final path
+ * @cache: last looked up target, or NULL
+ * @buf: buffer receiving the value, or NULL to only compute its length
+ * @buflen: size of @buf
+ *
+ * overlay_symbol_value() either copies a symbol recorded by
+ * fdt_overlay_resolve() or translates an overlay symbol with
+ * overlay_symbol_path().
+ *
+ * returns:
+ *      the length of the value
+ *      0, if the symbol is not to be added to the base tree
+ *      Negative error code on failure
+ */
+static int overlay_symbol_value(const void *fdt, const void *fdto, int prop,
+				int copy, struct overlay_target *cache,
+				char *buf, int buflen)
+{
+	const char *val;
+	int len;
+
+	if (!copy)
+		return overlay_symbol_path(fdt, fdto, prop, cache,
+					   buf, buflen);
+
+	val = fdt_getprop_by_offset(fdto, prop, NULL, &len);
+	if (!val)
+		return len;
+
+	if (buf) {
+		if (buflen < len)
+			return -FDT_ERR_INTERNAL;
+		memcpy(buf, val, len);
+	}
+
+	return len;
+}
+
+/**
+ * overlay_add_symbols - Add a set of overlay symbols to a __symbols__ node
+ * @fdt: Device tree blob receiving the symbols
+ * @sym: Node offset of the __symbols__ node in @fdt
+ * @base: Base Device Tree blob the symbols are computed against
+ * @fdto: Device tree overlay blob
+ * @src_path: path of the node holding the symbols in @fdto
+ * @copy: whether the symbols already hold their final paths
+ *
+ * overlay_add_symbols() adds or updates a property of @sym for each
+ * symbol of @src_path. Symbols already present in @sym are updated in
+ * place; all the other ones are sized first, then written into a gap
+ * opened with a single splice of @fdt. The properties end up in the
+ * same order as if they had been added one by one.
+ *
+ * @fdt and @fdto may be the same blob, as long as @sym precedes
+ * @src_path in it.
+ *
+ * returns:
+ *      0 on success
+ *      Negative error code on failure
+ */
+static int overlay_add_symbols(void *fdt, int sym, const void *base,
+			       const void *fdto, const char *src_path,
+			       int copy)
+{
+	struct overlay_target cache;
+	int src, prop, len, size, offset, ret;
+	const char *name;
+	void *p;
+
+	src = fdt_path_offset(fdto, src_path);
+	if (src < 0)
+		return src;
+
+	/* update the symbols the base already has, this is rare */
+	fdt_for_each_property_offset(prop, fdto, src) {
+		if (!fdt_getprop_by_offset(fdto, prop, &name, &len))
+			return len;
+
+		if (!fdt_get_property(fdt, sym, name, NULL))
+			continue;
+
+		len = overlay_symbol_value(base, fdto, prop, copy, NULL,
+					   NULL, 0);
+		if (len < 0)
+			return len;
+		if (!len)
+			continue;
+
+		ret = fdt_setprop_placeholder(fdt, sym, name, len, &p);
+		if (ret < 0)
+			return ret;
+
+		/* again in case setprop_placeholder moved the target */
+		ret = overlay_symbol_value(base, fdto, prop, copy, NULL,
+					   p, len);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* size the new ones */
+	size = 0;
+	cache.fragment = -1;
+	fdt_for_each_property_offset(prop, fdto, src) {
+		if (!fdt_getprop_by_offset(fdto, prop, &name, &len))
+			return len;
+
+		if (fdt_get_property(fdt, sym, name, NULL))
+			continue;
+
+		len = overlay_symbol_value(base, fdto, prop, copy, &cache,
+					   NULL, 0);
+		if (len < 0)
+			return len;
+		if (!len)
+			continue;
+
+		size += sizeof(struct fdt_property) + FDT_TAGALIGN(len);
+	}
+
+	if (!size)
+		return 0;
+
+	offset = fdt_reserve_props_(fdt, sym, size);
+	if (offset < 0)
+		return offset;
+
+	/* the symbols may have moved if they live in the same blob */
+	src = fdt_path_offset(fdto, src_path);
+	if (src < 0)
+		return src;
+
+	/*
+	 * Fill the gap from its end, as adding the properties one by one
+	 * would have left the last one first.
+	 */
+	cache.fragment = -1;
+	fdt_for_each_property_offset(prop, fdto, src) {
+		if (!fdt_getprop_by_offset(fdto, prop, &name, &len))
+			return len;
+
+		len = overlay_symbol_value(base, fdto, prop, copy, &cache,
+					   NULL, 0);
+		if (len < 0)
+			return len;
+		if (!len)
+			continue;
+
+		if (fdt_get_property(fdt, sym, name, NULL))
+			continue;
+
+		size -= sizeof(struct fdt_property) + FDT_TAGALIGN(len);
+		if (size < 0)
+			return -FDT_ERR_INTERNAL;
+
+		ret = fdt_fill_prop_(fdt, offset + size, name, len, &p);
+		if (ret < 0)
+			return ret;
+
+		ret = overlay_symbol_value(base, fdto, prop, copy, &cache,
+					   p, len);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 /**
  * overlay_symbol_update - Update the symbols of base tree after a merge
  * @fdt: Base Device Tree blob
  * @fdto: Device tree overlay blob
+ * @src_path: path of the symbols in the overlay
+ * @copy: whether the symbols already hold their final paths
  *
  * overlay_symbol_update() updates the symbols of the base tree with the
- * symbols of the applied overlay
+ * symbols of the applied overlay, either the ones of its __symbols__
+ * node or the ones recorded by fdt_overlay_resolve().
  *
  * This is the last step in the device tree overlay application
  * process, allowing the reference of overlay symbols by subsequent
@@ -677,20 +1010,12 @@ static int get_path_len(const void *fdt, int nodeoffset)
  *      0 on success
  *      Negative error code on failure
  */
-static int overlay_symbol_update(void *fdt, void *fdto)
+static int overlay_symbol_update(void *fdt, void *fdto, const char *src_path,
+				 int copy)
 {
-	int root_sym, ov_sym, prop, path_len, fragment, target;
-	int len, frag_name_len, ret, rel_path_len;
-	const char *s, *e;
-	const char *path;
-	const char *name;
-	const char *frag_name;
-	const char *rel_path;
-	const char *target_path;
-	char *buf;
-	void *p;
+	int root_sym, ov_sym;
 
-	ov_sym = fdt_subnode_offset(fdto, 0, "__symbols__");
+	ov_sym = fdt_path_offset(fdto, src_path);
 
 	/* if no overlay symbols exist no problem */
 	if (ov_sym < 0)
@@ -706,141 +1031,259 @@ static int overlay_symbol_update(void *fdt, void *fdto)
 	if (root_sym < 0)
 		return root_sym;
 
-	/* iterate over each overlay symbol */
-	fdt_for_each_property_offset(prop, fdto, ov_sym) {
-		path = fdt_getprop_by_offset(fdto, prop, &name, &path_len);
-		if (!path)
-			return path_len;
+	return overlay_add_symbols(fdt, root_sym, fdt, fdto, src_path, copy);
+}
 
-		/* verify it's a string property (terminated by a single \0) */
-		if (path_len < 1 || memchr(path, '\0', path_len) != &path[path_len - 1])
-			return -FDT_ERR_BADVALUE;
+/**
+ * overlay_base_digest - Fingerprint a base device tree
+ * @fdt: Base Device Tree blob
+ * @digest: pointer which receives the digest
+ *
+ * overlay_base_digest() computes a 64-bit FNV-1a hash over the
+ * structure and strings blocks of @fdt. It identifies the base a
+ * resolved overlay has been prepared against; it is not meant to
+ * withstand deliberate collisions.
+ *
+ * returns:
+ *      0 on success
+ *      -FDT_ERR_BADVERSION, if @fdt predates the size_dt_struct field
+ */
+static int overlay_base_digest(const void *fdt, uint64_t *digest)
+{
+	const unsigned char *p;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned int i;
 
-		/* keep end marker to avoid strlen() */
-		e = path + path_len;
+	if (fdt_version(fdt) < 17)
+		return -FDT_ERR_BADVERSION;
 
-		if (*path != '/')
-			return -FDT_ERR_BADVALUE;
+	p = (const unsigned char *)fdt + fdt_off_dt_struct(fdt);
+	for (i = 0; i < fdt_size_dt_struct(fdt); i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
 
-		/* get fragment name first */
-		s = strchr(path + 1, '/');
-		if (!s) {
-			/* Symbol refers to something that won't end
-			 * up in the target tree */
-			continue;
-		}
+	p = (const unsigned char *)fdt + fdt_off_dt_strings(fdt);
+	for (i = 0; i < fdt_size_dt_strings(fdt); i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
 
-		frag_name = path + 1;
-		frag_name_len = s - path - 1;
-
-		/* verify format; safe since "s" lies in \0 terminated prop */
-		len = sizeof("/__overlay__/") - 1;
-		if ((e - s) > len && (memcmp(s, "/__overlay__/", len) == 0)) {
-			/* /<fragment-name>/__overlay__/<relative-subnode-path> */
-			rel_path = s + len;
-			rel_path_len = e - rel_path - 1;
-		} else if ((e - s) == len
-			   && (memcmp(s, "/__overlay__", len - 1) == 0)) {
-			/* /<fragment-name>/__overlay__ */
-			rel_path = "";
-			rel_path_len = 0;
-		} else {
-			/* Symbol refers to something that won't end
-			 * up in the target tree */
-			continue;
-		}
+	*digest = hash;
+	return 0;
+}
 
-		/* find the fragment index in which the symbol lies */
-		ret = fdt_subnode_offset_namelen(fdto, 0, frag_name,
-					       frag_name_len);
-		/* not found? */
-		if (ret < 0)
-			return -FDT_ERR_BADOVERLAY;
-		fragment = ret;
+/**
+ * overlay_resolve_phandles - Make the overlay phandles match a base tree
+ * @fdt: Base Device Tree blob
+ * @fdto: Device tree overlay blob
+ * @delta: Offset to shift the overlay local phandles of
+ *
+ * overlay_resolve_phandles() shifts the overlay local phandles and
+ * the references to them by @delta, then resolves the references to
+ * nodes of the base tree.
+ *
+ * returns:
+ *      0 on success
+ *      Negative error code on failure
+ */
+static int overlay_resolve_phandles(const void *fdt, void *fdto,
+				    uint32_t delta)
+{
+	int ret;
 
-		/* an __overlay__ subnode must exist */
-		ret = fdt_subnode_offset(fdto, fragment, "__overlay__");
-		if (ret < 0)
-			return -FDT_ERR_BADOVERLAY;
+	ret = overlay_adjust_local_phandles(fdto, delta);
+	if (ret)
+		return ret;
 
-		/* get the target of the fragment */
-		ret = fdt_overlay_target_offset(fdt, fdto, fragment, &target_path);
-		if (ret < 0)
-			return ret;
-		target = ret;
+	ret = overlay_update_local_references(fdto, delta);
+	if (ret)
+		return ret;
 
-		/* if we have a target path use */
-		if (!target_path) {
-			ret = get_path_len(fdt, target);
-			if (ret < 0)
-				return ret;
-			len = ret;
-		} else {
-			len = strlen(target_path);
-		}
+	return overlay_fixup_phandles(fdt, fdto);
+}
 
-		ret = fdt_setprop_placeholder(fdt, root_sym, name,
-				len + (len > 1) + rel_path_len + 1, &p);
-		if (ret < 0)
-			return ret;
+/**
+ * overlay_resolve_symbols - Record the base tree paths of the overlay symbols
+ * @fdt: Base Device Tree blob
+ * @fdto: Device tree overlay blob
+ * @resolved: Node offset of the __resolved__ node in the overlay
+ *
+ * overlay_resolve_symbols() stores the paths the overlay symbols will
+ * have in @fdt under a __symbols__ subnode of @resolved, so that
+ * applying the overlay can copy them instead of computing them again.
+ *
+ * returns:
+ *      0 on success
+ *      Negative error code on failure
+ */
+static int overlay_resolve_symbols(const void *fdt, void *fdto, int resolved)
+{
+	int ov_sym, res_sym;
 
-		if (!target_path) {
-			/* again in case setprop_placeholder changed it */
-			ret = fdt_overlay_target_offset(fdt, fdto, fragment, &target_path);
-			if (ret < 0)
-				return ret;
-			target = ret;
-		}
+	ov_sym = fdt_subnode_offset(fdto, 0, "__symbols__");
+	if (ov_sym == -FDT_ERR_NOTFOUND)
+		return 0;
+	if (ov_sym < 0)
+		return ov_sym;
 
-		buf = p;
-		if (len > 1) { /* target is not root */
-			if (!target_path) {
-				ret = fdt_get_path(fdt, target, buf, len + 1);
-				if (ret < 0)
-					return ret;
-			} else
-				memcpy(buf, target_path, len + 1);
-
-		} else
-			len--;
-
-		buf[len] = '/';
-		memcpy(buf + len + 1, rel_path, rel_path_len);
-		buf[len + 1 + rel_path_len] = '\0';
-	}
+	res_sym = fdt_add_subnode(fdto, resolved, "__symbols__");
+	if (res_sym < 0)
+		return res_sym;
+
+	return overlay_add_symbols(fdto, res_sym, fdt, fdto, "/__symbols__",
+				   0);
+}
+
+/**
+ * overlay_prepare_resolved - Check a resolved overlay against its base
+ * @fdt: Base Device Tree blob
+ * @fdto: Device tree overlay blob
+ * @resolved: Node offset of the __resolved__ node in the overlay
+ *
+ * overlay_prepare_resolved() compares the digest recorded by
+ * fdt_overlay_resolve() with the one of @fdt. If they differ, the
+ * overlay phandles are resolved again against @fdt, starting from the
+ * values computed for the original base.
+ *
+ * returns:
+ *      1, if the overlay was resolved against @fdt
+ *      0, if the overlay has been resolved again
+ *      Negative error code on failure
+ */
+static int overlay_prepare_resolved(void *fdt, void *fdto, int resolved)
+{
+	const fdt64_t *digest;
+	const fdt32_t *max;
+	uint64_t base_digest;
+	uint32_t delta;
+	int len, ret;
+
+	digest = fdt_getprop(fdto, resolved, "base-digest", &len);
+	if (!digest || len != sizeof(*digest))
+		return -FDT_ERR_BADOVERLAY;
+
+	max = fdt_getprop(fdto, resolved, "base-max-phandle", &len);
+	if (!max || len != sizeof(*max))
+		return -FDT_ERR_BADOVERLAY;
+
+	ret = overlay_base_digest(fdt, &base_digest);
+	if (ret)
+		return ret;
+
+	if (fdt64_ld(digest) == base_digest)
+		return 1;
+
+	ret = fdt_find_max_phandle(fdt, &delta);
+	if (ret)
+		return ret;
+
+	/*
+	 * Local phandles were shifted past the original base; they only
+	 * need to move again if this base has higher phandles.
+	 */
+	if (delta > fdt32_ld(max))
+		delta -= fdt32_ld(max);
+	else
+		delta = 0;
+
+	ret = overlay_resolve_phandles(fdt, fdto, delta);
+	if (ret)
+		return ret;
 
 	return 0;
 }
 
-int fdt_overlay_apply(void *fdt, void *fdto)
+int fdt_overlay_resolve(const void *fdt, void *fdto)
 {
+	uint64_t digest;
 	uint32_t delta;
+	int resolved;
 	int ret;
 
 	FDT_RO_PROBE(fdt);
 	FDT_RO_PROBE(fdto);
 
+	resolved = fdt_subnode_offset(fdto, 0, "__resolved__");
+	if (resolved >= 0)
+		return -FDT_ERR_EXISTS;
+	if (resolved != -FDT_ERR_NOTFOUND)
+		return resolved;
+
+	ret = overlay_base_digest(fdt, &digest);
+	if (ret)
+		return ret;
+
 	ret = fdt_find_max_phandle(fdt, &delta);
+	if (ret)
+		return ret;
+
+	ret = overlay_resolve_phandles(fdt, fdto, delta);
 	if (ret)
 		goto err;
 
-	ret = overlay_adjust_local_phandles(fdto, delta);
+	resolved = fdt_add_subnode(fdto, 0, "__resolved__");
+	if (resolved < 0) {
+		ret = resolved;
+		goto err;
+	}
+
+	ret = fdt_setprop_u64(fdto, resolved, "base-digest", digest);
 	if (ret)
 		goto err;
 
-	ret = overlay_update_local_references(fdto, delta);
+	ret = fdt_setprop_u32(fdto, resolved, "base-max-phandle", delta);
 	if (ret)
 		goto err;
 
-	ret = overlay_fixup_phandles(fdt, fdto);
+	ret = overlay_resolve_symbols(fdt, fdto, resolved);
 	if (ret)
 		goto err;
 
+	return 0;
+
+err:
+	/*
+	 * The overlay might have been damaged, erase its magic.
+	 */
+	fdt_set_magic(fdto, ~0);
+
+	return ret;
+}
+
+int fdt_overlay_apply(void *fdt, void *fdto)
+{
+	uint32_t delta;
+	int resolved, matched = 0;
+	int ret;
+
+	FDT_RO_PROBE(fdt);
+	FDT_RO_PROBE(fdto);
+
+	resolved = fdt_subnode_offset(fdto, 0, "__resolved__");
+	if (resolved >= 0) {
+		ret = overlay_prepare_resolved(fdt, fdto, resolved);
+		if (ret < 0)
+			goto err;
+		matched = ret;
+	} else if (resolved == -FDT_ERR_NOTFOUND) {
+		ret = fdt_find_max_phandle(fdt, &delta);
+		if (ret)
+			goto err;
+
+		ret = overlay_resolve_phandles(fdt, fdto, delta);
+		if (ret)
+			goto err;
+	} else {
+		ret = resolved;
+		goto err;
+	}
+
 	ret = overlay_merge(fdt, fdto);
 	if (ret)
 		goto err;
 
-	ret = overlay_symbol_update(fdt, fdto);
+	if (matched)
+		ret = overlay_symbol_update(fdt, fdto,
+					    "/__resolved__/__symbols__", 1);
+	else
+		ret = overlay_symbol_update(fdt, fdto, "/__symbols__", 0);
 	if (ret)
 		goto err;
 
@@ -113,8 +113,18 @@ static int fdt_string_eq_(const void *fdt, int stroffset,
 
 int fdt_find_max_phandle(const void *fdt, uint32_t *phandle)
 {
+	const fdt32_t *hint;
 	uint32_t max = 0;
 	int offset = -1;
+	int len;
+
+	hint = fdt_getprop(fdt, 0, FDT_MAX_PHANDLE_HINT, &len);
+	if (hint && (len == sizeof(*hint))
+	    && (fdt32_ld(hint) <= FDT_MAX_PHANDLE)) {
+		if (phandle)
+			*phandle = fdt32_ld(hint);
+		return 0;
+	}
 
 	while (true) {
 		uint32_t value;
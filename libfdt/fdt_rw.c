@@ -232,6 +232,52 @@ static int fdt_add_property_(void *fdt, int nodeoffset, const char *name,
 	return 0;
 }
 
+int fdt_reserve_props_(void *fdt, int nodeoffset, int len)
+{
+	fdt32_t *p;
+	int offset;
+	int err;
+	unsigned int i;
+
+	FDT_RW_PROBE(fdt);
+
+	if ((len < 0) || (len % FDT_TAGSIZE))
+		return -FDT_ERR_BADVALUE;
+
+	if ((offset = fdt_check_node_offset_(fdt, nodeoffset)) < 0)
+		return offset;
+
+	p = fdt_offset_ptr_w_(fdt, offset);
+	err = fdt_splice_struct_(fdt, p, 0, len);
+	if (err)
+		return err;
+
+	for (i = 0; i < (unsigned int)len / FDT_TAGSIZE; i++)
+		p[i] = cpu_to_fdt32(FDT_NOP);
+
+	return offset;
+}
+
+int fdt_fill_prop_(void *fdt, int offset, const char *name, int len,
+		   void **prop_data)
+{
+	struct fdt_property *prop;
+	int namestroff;
+	int allocated;
+
+	namestroff = fdt_find_add_string_(fdt, name, &allocated);
+	if (namestroff < 0)
+		return namestroff;
+
+	prop = fdt_offset_ptr_w_(fdt, offset);
+	prop->tag = cpu_to_fdt32(FDT_PROP);
+	prop->nameoff = cpu_to_fdt32(namestroff);
+	prop->len = cpu_to_fdt32(len);
+	memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
+	*prop_data = prop->data;
+	return 0;
+}
+
 int fdt_set_name(void *fdt, int nodeoffset, const char *name)
 {
 	char *namep;
@@ -255,14 +301,13 @@ int fdt_set_name(void *fdt, int nodeoffset, const char *name)
 	return 0;
 }
 
-int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
-			    int len, void **prop_data)
+static int fdt_setprop_placeholder_(void *fdt, int nodeoffset,
+				    const char *name, int len,
+				    void **prop_data)
 {
 	struct fdt_property *prop;
 	int err;
 
-	FDT_RW_PROBE(fdt);
-
 	err = fdt_resize_property_(fdt, nodeoffset, name, len, &prop);
 	if (err == -FDT_ERR_NOTFOUND)
 		err = fdt_add_property_(fdt, nodeoffset, name, len, &prop);
@@ -273,13 +318,25 @@ int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
 	return 0;
 }
 
+int fdt_setprop_placeholder(void *fdt, int nodeoffset, const char *name,
+			    int len, void **prop_data)
+{
+	FDT_RW_PROBE(fdt);
+
+	fdt_update_max_phandle_(fdt, nodeoffset, name, strlen(name), NULL, -1);
+	return fdt_setprop_placeholder_(fdt, nodeoffset, name, len, prop_data);
+}
+
 int fdt_setprop(void *fdt, int nodeoffset, const char *name,
 		const void *val, int len)
 {
 	void *prop_data;
 	int err;
 
-	err = fdt_setprop_placeholder(fdt, nodeoffset, name, len, &prop_data);
+	FDT_RW_PROBE(fdt);
+
+	fdt_update_max_phandle_(fdt, nodeoffset, name, strlen(name), val, len);
+	err = fdt_setprop_placeholder_(fdt, nodeoffset, name, len, &prop_data);
 	if (err)
 		return err;
 
@@ -296,6 +353,7 @@ int fdt_appendprop(void *fdt, int nodeoffset, const char *name,
 
 	FDT_RW_PROBE(fdt);
 
+	fdt_update_max_phandle_(fdt, nodeoffset, name, strlen(name), NULL, -1);
 	prop = fdt_get_property_w(fdt, nodeoffset, name, &oldlen);
 	if (prop) {
 		newlen = len + oldlen;
@@ -326,6 +384,7 @@ int fdt_delprop(void *fdt, int nodeoffset, const char *name)
 	if (!prop)
 		return len;
 
+	fdt_update_max_phandle_(fdt, nodeoffset, name, strlen(name), NULL, 0);
 	proplen = sizeof(*prop) + FDT_TAGALIGN(len);
 	return fdt_splice_struct_(fdt, prop, proplen, 0);
 }
@@ -389,6 +448,7 @@ int fdt_del_node(void *fdt, int nodeoffset)
 	if (endoffset < 0)
 		return endoffset;
 
+	fdt_drop_max_phandle_(fdt, nodeoffset, endoffset);
 	return fdt_splice_struct_(fdt, fdt_offset_ptr_w_(fdt, nodeoffset),
 				  endoffset - nodeoffset, 0);
 }
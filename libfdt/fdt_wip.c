@@ -26,6 +26,13 @@ int fdt_setprop_inplace_namelen_partial(void *fdt, int nodeoffset,
 	if ((unsigned)proplen < (len + idx))
 		return -FDT_ERR_NOSPACE;
 
+	if ((idx == 0) && (len == proplen))
+		fdt_update_max_phandle_(fdt, nodeoffset, name, namelen,
+					val, len);
+	else
+		fdt_update_max_phandle_(fdt, nodeoffset, name, namelen,
+					NULL, -1);
+
 	memcpy((char *)propval + idx, val, len);
 	return 0;
 }
@@ -65,11 +72,96 @@ int fdt_nop_property(void *fdt, int nodeoffset, const char *name)
 	if (!prop)
 		return len;
 
+	fdt_update_max_phandle_(fdt, nodeoffset, name, strlen(name), NULL, 0);
 	fdt_nop_region_(prop, len + sizeof(*prop));
 
 	return 0;
 }
 
+static bool fdt_is_phandle_name_(const char *name, int namelen)
+{
+	return ((namelen == 7) && !memcmp(name, "phandle", 7))
+		|| ((namelen == 13) && !memcmp(name, "linux,phandle", 13));
+}
+
+static fdt32_t *fdt_max_phandle_hint_w_(void *fdt)
+{
+	fdt32_t *hint;
+	int len;
+
+	hint = fdt_getprop_w(fdt, 0, FDT_MAX_PHANDLE_HINT, &len);
+	if (!hint || (len != sizeof(*hint)))
+		return NULL;
+
+	return hint;
+}
+
+static void fdt_drop_max_phandle_hint_(void *fdt)
+{
+	struct fdt_property *prop;
+	int len;
+
+	prop = fdt_get_property_w(fdt, 0, FDT_MAX_PHANDLE_HINT, &len);
+	if (prop)
+		fdt_nop_region_(prop, len + sizeof(*prop));
+}
+
+void fdt_update_max_phandle_(void *fdt, int nodeoffset, const char *name,
+			     int namelen, const void *val, int len)
+{
+	const void *old;
+	fdt32_t *hint;
+	uint32_t max, phandle;
+	int oldlen;
+
+	if (!fdt_is_phandle_name_(name, namelen))
+		return;
+
+	hint = fdt_max_phandle_hint_w_(fdt);
+	if (!hint)
+		return;
+	max = fdt32_ld(hint);
+
+	if (len < 0) {
+		fdt_drop_max_phandle_hint_(fdt);
+		return;
+	}
+
+	if (len == sizeof(fdt32_t)) {
+		phandle = fdt32_ld(val);
+		if ((phandle > max) && (phandle <= FDT_MAX_PHANDLE)) {
+			fdt32_st(hint, phandle);
+			return;
+		}
+		if (phandle == max)
+			return;
+	}
+
+	/* The old value may have been the highest one */
+	old = fdt_getprop_namelen(fdt, nodeoffset, name, namelen, &oldlen);
+	if (old && (oldlen == sizeof(fdt32_t)) && (fdt32_ld(old) == max))
+		fdt_drop_max_phandle_hint_(fdt);
+}
+
+void fdt_drop_max_phandle_(void *fdt, int nodeoffset, int endoffset)
+{
+	fdt32_t *hint;
+	uint32_t max;
+	int offset, depth = 0;
+
+	hint = fdt_max_phandle_hint_w_(fdt);
+	if (!hint || !fdt32_ld(hint))
+		return;
+	max = fdt32_ld(hint);
+
+	for (offset = nodeoffset; (offset >= 0) && (offset < endoffset);
+	     offset = fdt_next_node(fdt, offset, &depth))
+		if (fdt_get_phandle(fdt, offset) == max) {
+			fdt_drop_max_phandle_hint_(fdt);
+			return;
+		}
+}
+
 int fdt_node_end_offset_(void *fdt, int offset)
 {
 	int depth = 0;
@@ -88,6 +180,7 @@ int fdt_nop_node(void *fdt, int nodeoffset)
 	if (endoffset < 0)
 		return endoffset;
 
+	fdt_drop_max_phandle_(fdt, nodeoffset, endoffset);
 	fdt_nop_region_(fdt_offset_ptr_w(fdt, nodeoffset, 0),
 			endoffset - nodeoffset);
 	return 0;
@@ -375,6 +375,11 @@ const char *fdt_string(const void *fdt, int stroffset);
  * tree. The value returned in @phandle is only valid if the function returns
  * success.
  *
+ * If the root node has a FDT_MAX_PHANDLE_HINT property (see dtc -M), its
+ * value is returned without a scan of the tree. The libfdt write functions
+ * raise this hint for a new, higher phandle, and remove it whenever the
+ * highest phandle is changed or removed.
+ *
  * returns:
  *     0 on success or a negative error code on failure
  */
@@ -2123,6 +2128,48 @@ int fdt_del_node(void *fdt, int nodeoffset);
  */
 int fdt_overlay_apply(void *fdt, void *fdto);
 
+/**
+ * fdt_overlay_resolve - Prepare a DT overlay for a known base DT
+ * @fdt: pointer to the base device tree blob
+ * @fdto: pointer to the device tree overlay blob
+ *
+ * fdt_overlay_resolve() performs the phandle adjustments and fixups
+ * fdt_overlay_apply() would do for the given base device tree, and
+ * records the resulting symbol paths along with a digest of the base
+ * in a /__resolved__ node of the overlay.
+ *
+ * Applying the resolved overlay to a base with the same digest then
+ * only merges the fragments. On any other base, fdt_overlay_apply()
+ * resolves the overlay phandles again and behaves as usual.
+ *
+ * The digest is a plain 64-bit hash of the structure and strings
+ * blocks, not a cryptographic one: it only guards against applying an
+ * overlay to the wrong base by mistake.
+ *
+ * The base device tree is not modified. Expect the overlay to be
+ * damaged if the function returns an error.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_EXISTS, the overlay has already been resolved
+ *	-FDT_ERR_NOSPACE, there's not enough space in the overlay
+ *	-FDT_ERR_NOTFOUND, the overlay points to some inexistant nodes or
+ *		properties in the base DT
+ *	-FDT_ERR_BADPHANDLE,
+ *	-FDT_ERR_BADOVERLAY,
+ *	-FDT_ERR_NOPHANDLES,
+ *	-FDT_ERR_INTERNAL,
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADOFFSET,
+ *	-FDT_ERR_BADPATH,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_overlay_resolve(const void *fdt, void *fdto);
+
 /**
  * fdt_overlay_target_offset - retrieves the offset of a fragment's target
  * @fdt: Base device tree blob
@@ -23,6 +23,32 @@ int fdt_check_prop_offset_(const void *fdt, int offset);
 const char *fdt_find_string_(const char *strtab, int tabsize, const char *s);
 int fdt_node_end_offset_(void *fdt, int nodeoffset);
 
+/*
+ * Batched property insertion: fdt_reserve_props_() opens a gap of @len
+ * bytes of FDT_NOP tags in front of the properties of a node with a
+ * single splice and returns its offset, and fdt_fill_prop_() turns
+ * the NOPs at @offset into a property of @len bytes of data, which the
+ * caller fills in through @prop_data. The caller is responsible for
+ * staying within the reserved gap.
+ */
+int fdt_reserve_props_(void *fdt, int nodeoffset, int len);
+int fdt_fill_prop_(void *fdt, int offset, const char *name, int len,
+		   void **prop_data);
+
+/*
+ * Max phandle hint maintenance: fdt_update_max_phandle_() must be
+ * called before property @name of the node at @nodeoffset is given a
+ * new value of @len bytes at @val, or removed (@val NULL and @len 0).
+ * A negative @len means the new value is not known yet. It raises the
+ * hint in place for a higher phandle and drops it whenever the highest
+ * phandle could go away. fdt_drop_max_phandle_() does the latter for
+ * the removal of the nodes between @nodeoffset and @endoffset. Neither
+ * moves anything in the blob.
+ */
+void fdt_update_max_phandle_(void *fdt, int nodeoffset, const char *name,
+			     int namelen, const void *val, int len);
+void fdt_drop_max_phandle_(void *fdt, int nodeoffset, int endoffset);
+
 static inline const void *fdt_offset_ptr_(const void *fdt, int offset)
 {
 	return (const char *)fdt + fdt_off_dt_struct(fdt) + offset;
@@ -10,22 +10,213 @@
  * Tree building functions
  */
 
-void add_label(struct label **labels, char *label)
+/*
+ * Bumped by every change which can affect what a phandle refers to, or
+ * where the search for an interrupt parent stops, so that the indexes
+ * of a tree know when to rebuild.
+ */
+static unsigned int tree_generation = 1;
+
+/*
+ * The label index of a tree (below) follows most changes in place;
+ * this is bumped by those it can't, such as sorting.
+ */
+static unsigned int label_generation = 1;
+
+enum label_change {
+	LABEL_REBUILD,		/* a full walk, meeting labels in order */
+	LABEL_ADDED,
+	LABEL_REMOVED,
+};
+
+struct label_table;
+static struct label_table *indexed_labels(struct node *node);
+static void index_labels(struct label_table *tab, struct node *tree,
+			 enum label_change change);
+static void index_prop_labels(struct label_table *tab, struct node *node,
+			      struct property *prop, enum label_change change);
+static void index_marker_labels(struct label_table *tab, struct node *node,
+				struct property *prop,
+				enum label_change change);
+static void index_label(struct label_table *tab, const char *label,
+			struct node *node, struct property *prop,
+			struct marker *mark, enum label_change change);
+
+/*
+ * Nodes with many properties or children (pinctrl, __symbols__,
+ * generated memory maps...) get a hash index of each list, once a
+ * lookup or append has had to walk past NAME_INDEX_MIN entries.  An
+ * index maps each name to its first entry in list order, deleted or
+ * not, and remembers the tail of the list so appends don't walk it.
+ */
+#define NAME_INDEX_MIN	32
+
+struct name_index {
+	unsigned int size, count;
+	struct name_index_entry {
+		const char *name;
+		void *item;
+	} *slots;
+	void *last;
+};
+
+static struct name_index_entry *name_index_slot(struct name_index *idx,
+						const char *name, size_t len)
+{
+	unsigned int i = str_hash(name, len) & (idx->size - 1);
+
+	while (idx->slots[i].name && !strprefixeq(name, len, idx->slots[i].name))
+		i = (i + 1) & (idx->size - 1);
+
+	return &idx->slots[i];
+}
+
+/* Record item under name, unless an earlier entry already has it */
+static void name_index_add(struct name_index *idx, const char *name,
+			   void *item)
+{
+	struct name_index_entry *old = idx->slots, *e;
+	unsigned int n = idx->size, i;
+
+	idx->last = item;
+
+	if ((idx->count + 1) * 2 > idx->size) {
+		idx->size = n ? n * 2 : 2 * NAME_INDEX_MIN;
+		idx->slots = xmalloc(idx->size * sizeof(*idx->slots));
+		memset(idx->slots, 0, idx->size * sizeof(*idx->slots));
+		for (i = 0; i < n; i++)
+			if (old[i].name)
+				*name_index_slot(idx, old[i].name,
+						 strlen(old[i].name)) = old[i];
+		free(old);
+	}
+
+	e = name_index_slot(idx, name, strlen(name));
+	if (!e->name) {
+		e->name = name;
+		e->item = item;
+		idx->count++;
+	}
+}
+
+static void name_index_free(struct name_index **idxp)
+{
+	if (*idxp) {
+		free((*idxp)->slots);
+		free(*idxp);
+		*idxp = NULL;
+	}
+}
+
+static void index_properties(struct node *node)
+{
+	struct property *prop;
+
+	node->propindex = xmalloc(sizeof(*node->propindex));
+	memset(node->propindex, 0, sizeof(*node->propindex));
+
+	for_each_property_withdel(node, prop)
+		name_index_add(node->propindex, prop->name, prop);
+}
+
+static void index_children(struct node *node)
+{
+	struct node *child;
+
+	node->childindex = xmalloc(sizeof(*node->childindex));
+	memset(node->childindex, 0, sizeof(*node->childindex));
+
+	for_each_child_withdel(node, child)
+		name_index_add(node->childindex, child->name, child);
+}
+
+static struct property *find_property(struct node *node, const char *name,
+				      bool withdel)
+{
+	struct property *prop;
+	unsigned int n = 0;
+
+	if (node->propindex) {
+		prop = name_index_slot(node->propindex, name,
+				       strlen(name))->item;
+		/* Only a deleted first entry needs the list walked */
+		if (!prop || withdel || !prop->deleted)
+			return prop;
+	}
+
+	for_each_property_withdel(node, prop) {
+		n++;
+		if ((withdel || !prop->deleted) && streq(prop->name, name))
+			break;
+	}
+
+	if (!node->propindex && n >= NAME_INDEX_MIN)
+		index_properties(node);
+
+	return prop;
+}
+
+static struct node *find_child(struct node *node, const char *name,
+			       size_t len, bool withdel)
+{
+	struct node *child;
+	unsigned int n = 0;
+
+	if (node->childindex) {
+		child = name_index_slot(node->childindex, name, len)->item;
+		if (!child || withdel || !child->deleted)
+			return child;
+	}
+
+	for_each_child_withdel(node, child) {
+		n++;
+		if ((withdel || !child->deleted)
+		    && strprefixeq(name, len, child->name))
+			break;
+	}
+
+	if (!node->childindex && n >= NAME_INDEX_MIN)
+		index_children(node);
+
+	return child;
+}
+
+/* Returns the label if it is newly live, NULL if it already was */
+static struct label *attach_label(struct label **labels, char *label)
 {
 	struct label *new;
 
 	/* Make sure the label isn't already there */
 	for_each_label_withdel(*labels, new)
 		if (streq(new->label, label)) {
+			free(label);
+			if (!new->deleted)
+				return NULL;
 			new->deleted = 0;
-			return;
+			return new;
 		}
 
-	new = xmalloc(sizeof(*new));
+	new = arena_alloc(sizeof(*new));
 	memset(new, 0, sizeof(*new));
 	new->label = label;
 	new->next = *labels;
 	*labels = new;
+
+	return new;
+}
+
+void add_label(struct label **labels, char *label)
+{
+	attach_label(labels, label);
+}
+
+void add_node_label(struct node *node, char *label)
+{
+	struct label_table *tab = indexed_labels(node);
+	struct label *l = attach_label(&node->labels, label);
+
+	if (tab && l)
+		index_label(tab, l->label, node, NULL, NULL, LABEL_ADDED);
 }
 
 void delete_labels(struct label **labels)
@@ -39,7 +230,7 @@ void delete_labels(struct label **labels)
 struct property *build_property(char *name, struct data val,
 				struct srcpos *srcpos)
 {
-	struct property *new = xmalloc(sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -52,7 +243,7 @@ struct property *build_property(char *name, struct data val,
 
 struct property *build_property_delete(char *name)
 {
-	struct property *new = xmalloc(sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -88,7 +279,7 @@ struct property *reverse_properties(struct property *first)
 struct node *build_node(struct property *proplist, struct node *children,
 			struct srcpos *srcpos)
 {
-	struct node *new = xmalloc(sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 	struct node *child;
 
 	memset(new, 0, sizeof(*new));
@@ -106,7 +297,7 @@ struct node *build_node(struct property *proplist, struct node *children,
 
 struct node *build_node_delete(struct srcpos *srcpos)
 {
-	struct node *new = xmalloc(sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -139,17 +330,40 @@ struct node *reference_node(struct node *node)
 	return node;
 }
 
+/*
+ * Whether adding or deleting prop can change where the search for an
+ * interrupt parent stops (see index_irq_anchors())
+ */
+static bool prop_anchors_irqs(struct property *prop)
+{
+	return streq(prop->name, "interrupt-parent")
+		|| streq(prop->name, "interrupt-controller")
+		|| streq(prop->name, "interrupt-map");
+}
+
 struct node *merge_nodes(struct node *old_node, struct node *new_node)
 {
 	struct property *new_prop, *old_prop;
 	struct node *new_child, *old_child;
+	struct label_table *tab;
 	struct label *l;
 
+	/* A deleted node has nothing live left in it to come back */
 	old_node->deleted = 0;
+	tab = indexed_labels(old_node);
+
+	/* new_node's lists are taken apart below */
+	name_index_free(&new_node->propindex);
+	name_index_free(&new_node->childindex);
 
 	/* Add new node labels to old node */
-	for_each_label_withdel(new_node->labels, l)
-		add_label(&old_node->labels, l->label);
+	for_each_label_withdel(new_node->labels, l) {
+		struct label *nl = attach_label(&old_node->labels, l->label);
+
+		if (tab && nl)
+			index_label(tab, nl->label, old_node, NULL, NULL,
+				    LABEL_ADDED);
+	}
 
 	/* Move properties from the new node to the old node.  If there
 	 * is a collision, replace the old value with the new */
@@ -161,25 +375,39 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_prop->deleted) {
 			delete_property_by_name(old_node, new_prop->name);
-			free(new_prop);
+			free_property(new_prop);
 			continue;
 		}
 
 		/* Look for a collision, set new value if there is */
-		for_each_property_withdel(old_node, old_prop) {
-			if (streq(old_prop->name, new_prop->name)) {
-				/* Add new labels to old property */
-				for_each_label_withdel(new_prop->labels, l)
-					add_label(&old_prop->labels, l->label);
-
-				old_prop->val = new_prop->val;
-				old_prop->deleted = 0;
-				free(old_prop->srcpos);
-				old_prop->srcpos = new_prop->srcpos;
-				free(new_prop);
-				new_prop = NULL;
-				break;
+		old_prop = find_property(old_node, new_prop->name, true);
+		if (old_prop) {
+			if (tab && !old_prop->deleted)
+				index_marker_labels(tab, old_node, old_prop,
+						    LABEL_REMOVED);
+
+			/* Add new labels to old property */
+			for_each_label_withdel(new_prop->labels, l) {
+				struct label *nl;
+
+				nl = attach_label(&old_prop->labels, l->label);
+				if (tab && nl)
+					index_label(tab, nl->label, old_node,
+						    old_prop, NULL, LABEL_ADDED);
 			}
+
+			if (old_prop->deleted && prop_anchors_irqs(old_prop))
+				tree_generation++;
+
+			data_free(old_prop->val);
+			old_prop->val = new_prop->val;
+			old_prop->deleted = 0;
+			if (tab)
+				index_marker_labels(tab, old_node, old_prop,
+						    LABEL_ADDED);
+			old_prop->srcpos = new_prop->srcpos;
+			free(new_prop->name);
+			new_prop = NULL;
 		}
 
 		/* if no collision occurred, add property to the old node. */
@@ -198,17 +426,16 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_child->deleted) {
 			delete_node_by_name(old_node, new_child->name);
-			free(new_child);
+			free_node(new_child);
 			continue;
 		}
 
 		/* Search for a collision.  Merge if there is */
-		for_each_child_withdel(old_node, old_child) {
-			if (streq(old_child->name, new_child->name)) {
-				merge_nodes(old_child, new_child);
-				new_child = NULL;
-				break;
-			}
+		old_child = find_child(old_node, new_child->name,
+				       strlen(new_child->name), true);
+		if (old_child) {
+			merge_nodes(old_child, new_child);
+			new_child = NULL;
 		}
 
 		/* if no collision occurred, add child to the old node. */
@@ -218,16 +445,24 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 	old_node->srcpos = srcpos_extend(old_node->srcpos, new_node->srcpos);
 
-	/* The new node contents are now merged into the old node.  Free
-	 * the new node. */
-	free(new_node);
+	/* The new node contents are now merged into the old node, whose
+	 * shell is left to the arena.  Its labels went with them. */
+	free(new_node->name);
+	free(new_node->fullpath);
 
 	return old_node;
 }
 
+/* Fragments are numbered across all the trees an output is made from */
+static unsigned int next_orphan_fragment;
+
+void reset_orphan_fragments(void)
+{
+	next_orphan_fragment = 0;
+}
+
 struct node * add_orphan_node(struct node *dt, struct node *new_node, char *ref)
 {
-	static unsigned int next_orphan_fragment = 0;
 	struct node *node;
 	struct property *p;
 	struct data d = empty_data;
@@ -237,17 +472,17 @@ struct node * add_orphan_node(struct node *dt, struct node *new_node, char *ref)
 		d = data_add_marker(d, TYPE_STRING, ref);
 		d = data_append_data(d, ref, strlen(ref) + 1);
 
-		p = build_property("target-path", d, NULL);
+		p = build_property(xstrdup("target-path"), d, NULL);
 	} else {
 		d = data_add_marker(d, REF_PHANDLE, ref);
 		d = data_append_integer(d, 0xffffffff, 32);
 
-		p = build_property("target", d, NULL);
+		p = build_property(xstrdup("target"), d, NULL);
 	}
 
 	xasprintf(&name, "fragment@%u",
 			next_orphan_fragment++);
-	name_node(new_node, "__overlay__");
+	name_node(new_node, xstrdup("__overlay__"));
 	node = build_node(p, new_node, NULL);
 	name_node(node, name);
 
@@ -265,73 +500,117 @@ struct node *chain_node(struct node *first, struct node *list)
 
 void add_property(struct node *node, struct property *prop)
 {
+	struct label_table *tab = indexed_labels(node);
 	struct property **p;
 
 	prop->next = NULL;
 
-	p = &node->proplist;
-	while (*p)
-		p = &((*p)->next);
+	if (prop_anchors_irqs(prop))
+		tree_generation++;
+
+	if (node->propindex) {
+		p = node->propindex->last ?
+			&((struct property *)node->propindex->last)->next :
+			&node->proplist;
+	} else {
+		unsigned int n = 0;
+
+		p = &node->proplist;
+		while (*p) {
+			p = &((*p)->next);
+			n++;
+		}
+		if (n >= NAME_INDEX_MIN)
+			index_properties(node);
+	}
 
 	*p = prop;
+	if (node->propindex)
+		name_index_add(node->propindex, prop->name, prop);
+
+	if (tab && !prop->deleted)
+		index_prop_labels(tab, node, prop, LABEL_ADDED);
 }
 
 void delete_property_by_name(struct node *node, char *name)
 {
-	struct property *prop = node->proplist;
+	struct property *prop = find_property(node, name, true);
 
-	while (prop) {
-		if (streq(prop->name, name)) {
-			delete_property(prop);
-			return;
-		}
-		prop = prop->next;
-	}
+	if (prop)
+		delete_property(node, prop);
 }
 
-void delete_property(struct property *prop)
+void delete_property(struct node *node, struct property *prop)
 {
+	struct label_table *tab = indexed_labels(node);
+
+	if (prop_anchors_irqs(prop))
+		tree_generation++;
+	if (tab && !prop->deleted)
+		index_prop_labels(tab, node, prop, LABEL_REMOVED);
+
 	prop->deleted = 1;
 	delete_labels(&prop->labels);
 }
 
 void add_child(struct node *parent, struct node *child)
 {
+	struct label_table *tab;
 	struct node **p;
 
+	tree_generation++;
+
 	child->next_sibling = NULL;
 	child->parent = parent;
 
-	p = &parent->children;
-	while (*p)
-		p = &((*p)->next_sibling);
+	if (parent->childindex) {
+		p = parent->childindex->last ?
+			&((struct node *)parent->childindex->last)->next_sibling :
+			&parent->children;
+	} else {
+		unsigned int n = 0;
+
+		p = &parent->children;
+		while (*p) {
+			p = &((*p)->next_sibling);
+			n++;
+		}
+		if (n >= NAME_INDEX_MIN)
+			index_children(parent);
+	}
 
 	*p = child;
+	if (parent->childindex)
+		name_index_add(parent->childindex, child->name, child);
+
+	tab = indexed_labels(parent);
+	if (tab && !child->deleted)
+		index_labels(tab, child, LABEL_ADDED);
 }
 
 void delete_node_by_name(struct node *parent, char *name)
 {
-	struct node *node = parent->children;
+	struct node *node = find_child(parent, name, strlen(name), true);
 
-	while (node) {
-		if (streq(node->name, name)) {
-			delete_node(node);
-			return;
-		}
-		node = node->next_sibling;
-	}
+	if (node)
+		delete_node(node);
 }
 
 void delete_node(struct node *node)
 {
+	struct label_table *tab = indexed_labels(node);
 	struct property *prop;
 	struct node *child;
 
+	tree_generation++;
+	if (tab && !node->deleted)
+		index_labels(tab, node, LABEL_REMOVED);
+
 	node->deleted = 1;
 	for_each_child(node, child)
 		delete_node(child);
 	for_each_property(node, prop)
-		delete_property(prop);
+		delete_property(node, prop);
 	delete_labels(&node->labels);
 }
 
@@ -344,20 +623,20 @@ void append_to_property(struct node *node,
 
 	p = get_property(node, name);
 	if (p) {
-		d = data_add_marker(p->val, type, name);
+		d = data_add_marker(p->val, type, xstrdup(name));
 		d = data_append_data(d, data, len);
 		p->val = d;
 	} else {
-		d = data_add_marker(empty_data, type, name);
+		d = data_add_marker(empty_data, type, xstrdup(name));
 		d = data_append_data(d, data, len);
-		p = build_property(name, d, NULL);
+		p = build_property(xstrdup(name), d, NULL);
 		add_property(node, p);
 	}
 }
 
 struct reserve_info *build_reserve_entry(uint64_t address, uint64_t size)
 {
-	struct reserve_info *new = xmalloc(sizeof(*new));
+	struct reserve_info *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -400,7 +679,7 @@ struct dt_info *build_dt_info(unsigned int dtsflags,
 {
 	struct dt_info *dti;
 
-	dti = xmalloc(sizeof(*dti));
+	dti = arena_alloc(sizeof(*dti));
 	dti->dtsflags = dtsflags;
 	dti->reservelist = reservelist;
 	dti->dt = tree;
@@ -423,13 +702,7 @@ const char *get_unitname(struct node *node)
 
 struct property *get_property(struct node *node, const char *propname)
 {
-	struct property *prop;
-
-	for_each_property(node, prop)
-		if (streq(prop->name, propname))
-			return prop;
-
-	return NULL;
+	return find_property(node, propname, false);
 }
 
 cell_t propval_cell(struct property *prop)
@@ -444,69 +717,255 @@ cell_t propval_cell_n(struct property *prop, unsigned int n)
 	return fdt32_to_cpu(*((fdt32_t *)prop->val.val + n));
 }
 
-struct property *get_property_by_label(struct node *tree, const char *label,
-				       struct node **node)
+/*
+ * Label index: for every label, the first node, property and value
+ * marker which carry it, in the order a depth first walk of the tree
+ * meets them, and how many of each carry it.  It hangs off the tree it
+ * was built for.  Adding and deleting labels, properties and subtrees
+ * updates it in place; only a change which may hand a label to a
+ * different first holder than before (which takes duplicate labels)
+ * marks it for rebuilding.
+ */
+enum label_kind {
+	NODE_LABEL,
+	PROP_LABEL,
+	MARKER_LABEL,
+};
+
+struct label_entry {
+	char *label;
+	struct label_holder {
+		unsigned int count;
+		struct node *node;
+		struct property *prop;
+		struct marker *mark;
+	} first[3];
+};
+
+struct label_table {
+	unsigned int generation;
+	unsigned int size, count;
+	struct label_entry *slots;
+};
+
+static struct label_entry *label_slot(struct label_table *tab,
+				      const char *label)
 {
-	struct property *prop;
-	struct node *c;
+	unsigned int i = str_hash(label, strlen(label)) & (tab->size - 1);
 
-	*node = tree;
+	while (tab->slots[i].label && !streq(tab->slots[i].label, label))
+		i = (i + 1) & (tab->size - 1);
 
-	for_each_property(tree, prop) {
-		struct label *l;
+	return &tab->slots[i];
+}
 
-		for_each_label(prop->labels, l)
-			if (streq(l->label, label))
-				return prop;
+static struct label_entry *label_entry(struct label_table *tab,
+				       const char *label)
+{
+	struct label_entry *old = tab->slots, *e;
+	unsigned int n = tab->size, i;
+
+	if ((tab->count + 1) * 2 > tab->size) {
+		tab->size = n ? n * 2 : 64;
+		tab->slots = xmalloc(tab->size * sizeof(*tab->slots));
+		memset(tab->slots, 0, tab->size * sizeof(*tab->slots));
+		for (i = 0; i < n; i++)
+			if (old[i].label)
+				*label_slot(tab, old[i].label) = old[i];
+		free(old);
 	}
 
-	for_each_child(tree, c) {
-		prop = get_property_by_label(c, label, node);
-		if (prop)
-			return prop;
+	e = label_slot(tab, label);
+	if (!e->label) {
+		e->label = xstrdup(label);
+		tab->count++;
 	}
 
-	*node = NULL;
-	return NULL;
+	return e;
 }
 
-struct marker *get_marker_label(struct node *tree, const char *label,
-				struct node **node, struct property **prop)
+static void label_table_clear(struct label_table *tab)
 {
-	struct marker *m;
-	struct property *p;
-	struct node *c;
+	unsigned int i;
 
-	*node = tree;
+	for (i = 0; i < tab->size; i++)
+		free(tab->slots[i].label);
+	free(tab->slots);
+	memset(tab, 0, sizeof(*tab));
+}
+
+/* The label index node's labels belong in, if it is up to date */
+static struct label_table *indexed_labels(struct node *node)
+{
+	struct label_table *tab;
 
-	for_each_property(tree, p) {
-		*prop = p;
-		m = p->val.markers;
-		for_each_marker_of_type(m, LABEL)
-			if (streq(m->ref, label))
-				return m;
+	for (;;) {
+		if (node->deleted)
+			return NULL;
+		if (!node->parent)
+			break;
+		node = node->parent;
 	}
 
-	for_each_child(tree, c) {
-		m = get_marker_label(c, label, node, prop);
-		if (m)
-			return m;
+	tab = node->labeltab;
+	if (!tab || (tab->generation != label_generation))
+		return NULL;
+
+	return tab;
+}
+
+/*
+ * Count a holder of label in or out.  A rebuild meets the holders in
+ * tree order, so the first one it counts is the first; a change to an
+ * up to date index can't tell where a second holder falls in that
+ * order, or which one takes over from a removed first, so leaves that
+ * to a rebuild.
+ */
+static void index_label(struct label_table *tab, const char *label,
+			struct node *node, struct property *prop,
+			struct marker *mark, enum label_change change)
+{
+	enum label_kind kind = mark ? MARKER_LABEL :
+		(prop ? PROP_LABEL : NODE_LABEL);
+	struct label_holder *h;
+
+	if (tab->generation != label_generation)
+		return;
+
+	h = &label_entry(tab, label)->first[kind];
+
+	if (change == LABEL_REMOVED) {
+		if (!h->count || (--h->count && (h->node == node)
+				  && (h->prop == prop) && (h->mark == mark)))
+			tab->generation = 0;
+		else if (!h->count)
+			memset(h, 0, sizeof(*h));
+		return;
 	}
 
-	*prop = NULL;
-	*node = NULL;
-	return NULL;
+	if (h->count++) {
+		if (change == LABEL_ADDED)
+			tab->generation = 0;
+		return;
+	}
+
+	h->node = node;
+	h->prop = prop;
+	h->mark = mark;
 }
 
-struct node *get_subnode(struct node *node, const char *nodename)
+static void index_marker_labels(struct label_table *tab, struct node *node,
+				struct property *prop,
+				enum label_change change)
+{
+	struct marker *m = prop->val.markers;
+
+	for_each_marker_of_type(m, LABEL)
+		index_label(tab, m->ref, node, prop, m, change);
+}
+
+static void index_prop_labels(struct label_table *tab, struct node *node,
+			      struct property *prop, enum label_change change)
+{
+	struct label *l;
+
+	for_each_label(prop->labels, l)
+		index_label(tab, l->label, node, prop, NULL, change);
+
+	index_marker_labels(tab, node, prop, change);
+}
+
+/* Count in or out the live labels of tree and everything under it */
+static void index_labels(struct label_table *tab, struct node *tree,
+			 enum label_change change)
 {
+	struct property *prop;
 	struct node *child;
+	struct label *l;
 
-	for_each_child(node, child)
-		if (streq(child->name, nodename))
-			return child;
+	for_each_label(tree->labels, l)
+		index_label(tab, l->label, tree, NULL, NULL, change);
 
-	return NULL;
+	for_each_property(tree, prop)
+		index_prop_labels(tab, tree, prop, change);
+
+	for_each_child(tree, child)
+		index_labels(tab, child, change);
+}
+
+static struct label_table *label_table(struct node *tree)
+{
+	struct label_table *tab = tree->labeltab;
+
+	if (!tab) {
+		tab = xmalloc(sizeof(*tab));
+		memset(tab, 0, sizeof(*tab));
+		tree->labeltab = tab;
+	}
+
+	if (tab->generation != label_generation) {
+		label_table_clear(tab);
+		tab->generation = label_generation;
+		index_labels(tab, tree, LABEL_REBUILD);
+	}
+
+	return tab;
+}
+
+static void label_table_free(struct node *tree)
+{
+	if (tree->labeltab) {
+		label_table_clear(tree->labeltab);
+		free(tree->labeltab);
+		tree->labeltab = NULL;
+	}
+}
+
+static struct label_entry *lookup_label(struct node *tree, const char *label)
+{
+	struct label_table *tab = label_table(tree);
+	struct label_entry *e;
+
+	if (!tab->size)
+		return NULL;
+
+	e = label_slot(tab, label);
+	return e->label ? e : NULL;
+}
+
+struct property *get_property_by_label(struct node *tree, const char *label,
+				       struct node **node)
+{
+	struct label_entry *e = lookup_label(tree, label);
+
+	if (!e || !e->first[PROP_LABEL].count) {
+		*node = NULL;
+		return NULL;
+	}
+
+	*node = e->first[PROP_LABEL].node;
+	return e->first[PROP_LABEL].prop;
+}
+
+struct marker *get_marker_label(struct node *tree, const char *label,
+				struct node **node, struct property **prop)
+{
+	struct label_entry *e = lookup_label(tree, label);
+
+	if (!e || !e->first[MARKER_LABEL].count) {
+		*node = NULL;
+		*prop = NULL;
+		return NULL;
+	}
+
+	*node = e->first[MARKER_LABEL].node;
+	*prop = e->first[MARKER_LABEL].prop;
+	return e->first[MARKER_LABEL].mark;
+}
+
+struct node *get_subnode(struct node *node, const char *nodename)
+{
+	return find_child(node, nodename, strlen(nodename), false);
 }
 
 struct node *get_node_by_path(struct node *tree, const char *path)
@@ -525,58 +984,234 @@ struct node *get_node_by_path(struct node *tree, const char *path)
 
 	p = strchr(path, '/');
 
-	for_each_child(tree, child) {
-		if (p && strprefixeq(path, (size_t)(p - path), child->name))
-			return get_node_by_path(child, p+1);
-		else if (!p && streq(path, child->name))
-			return child;
-	}
+	if (!p)
+		return get_subnode(tree, path);
 
-	return NULL;
+	child = find_child(tree, path, (size_t)(p - path), false);
+	if (!child)
+		return NULL;
+
+	return get_node_by_path(child, p+1);
 }
 
 struct node *get_node_by_label(struct node *tree, const char *label)
 {
-	struct node *child, *node;
-	struct label *l;
+	struct label_entry *e;
 
 	assert(label && (strlen(label) > 0));
 
-	for_each_label(tree->labels, l)
-		if (streq(l->label, label))
-			return tree;
+	e = lookup_label(tree, label);
+	return e ? e->first[NODE_LABEL].node : NULL;
+}
 
-	for_each_child(tree, child) {
-		node = get_node_by_label(child, label);
-		if (node)
-			return node;
+/*
+ * Phandle index: the node which has each phandle, filled from the tree
+ * when first needed (or when tree_generation has moved on) and kept up
+ * to date by set_node_phandle() as the checks and get_node_phandle()
+ * hand phandles out.
+ */
+struct phandle_table {
+	unsigned int generation;
+	unsigned int size, count;
+	struct node **slots;
+	cell_t next;		/* no free phandle below this one */
+};
+
+static struct node **phandle_slot(struct phandle_table *tab, cell_t phandle)
+{
+	unsigned int i = (phandle * 2654435761u) & (tab->size - 1);
+
+	while (tab->slots[i] && (tab->slots[i]->phandle != phandle))
+		i = (i + 1) & (tab->size - 1);
+
+	return &tab->slots[i];
+}
+
+static void phandle_table_add(struct phandle_table *tab, struct node *node)
+{
+	struct node **old = tab->slots, **slot;
+	unsigned int n = tab->size, i;
+
+	if ((tab->count + 1) * 2 > tab->size) {
+		tab->size = n ? n * 2 : 64;
+		tab->slots = xmalloc(tab->size * sizeof(*tab->slots));
+		memset(tab->slots, 0, tab->size * sizeof(*tab->slots));
+		for (i = 0; i < n; i++)
+			if (old[i])
+				*phandle_slot(tab, old[i]->phandle) = old[i];
+		free(old);
 	}
 
-	return NULL;
+	slot = phandle_slot(tab, node->phandle);
+	if (!*slot) {
+		*slot = node;
+		tab->count++;
+	}
+}
+
+static void index_phandles(struct phandle_table *tab, struct node *tree)
+{
+	struct node *child;
+
+	if (phandle_is_valid(tree->phandle))
+		phandle_table_add(tab, tree);
+
+	for_each_child(tree, child)
+		index_phandles(tab, child);
+}
+
+static struct phandle_table *phandle_table(struct node *tree)
+{
+	struct phandle_table *tab = tree->phandletab;
+
+	if (!tab) {
+		tab = xmalloc(sizeof(*tab));
+		memset(tab, 0, sizeof(*tab));
+		tab->next = 1;
+		tree->phandletab = tab;
+	}
+
+	if (tab->generation != tree_generation) {
+		free(tab->slots);
+		tab->slots = NULL;
+		tab->size = tab->count = 0;
+		index_phandles(tab, tree);
+		tab->generation = tree_generation;
+	}
+
+	return tab;
+}
+
+static void phandle_table_free(struct node *tree)
+{
+	if (tree->phandletab) {
+		free(tree->phandletab->slots);
+		free(tree->phandletab);
+		tree->phandletab = NULL;
+	}
+}
+
+static void index_lists(struct node *node)
+{
+	struct property *prop;
+	struct node *child;
+	unsigned int n = 0;
+
+	if (!node->propindex) {
+		for_each_property_withdel(node, prop)
+			n++;
+		if (n >= NAME_INDEX_MIN)
+			index_properties(node);
+	}
+
+	n = 0;
+	for_each_child_withdel(node, child) {
+		index_lists(child);
+		n++;
+	}
+	if (!node->childindex && n >= NAME_INDEX_MIN)
+		index_children(node);
+}
+
+bool node_is_interrupt_provider(struct node *node)
+{
+	struct property *prop;
+
+	prop = get_property(node, "interrupt-controller");
+	if (prop)
+		return true;
+
+	prop = get_property(node, "interrupt-map");
+	if (prop)
+		return true;
+
+	return false;
+}
+
+/*
+ * Interrupt parent index: for every node, the closest node at or above
+ * it which is an interrupt provider or has an "interrupt-parent", which
+ * is where the search for the interrupt parent of its children stops.
+ * Filled top-down from the root when first needed (or when
+ * tree_generation has moved on).
+ */
+static void index_irq_anchors(struct node *node, struct node *anchor)
+{
+	struct node *child;
+
+	if (node_is_interrupt_provider(node)
+	    || get_property(node, "interrupt-parent"))
+		anchor = node;
+	node->irqanchor = anchor;
+
+	for_each_child(node, child)
+		index_irq_anchors(child, anchor);
+}
+
+static void irq_anchors(struct node *tree)
+{
+	if (tree->irqgeneration != tree_generation) {
+		index_irq_anchors(tree, NULL);
+		tree->irqgeneration = tree_generation;
+	}
+}
+
+/*
+ * The node which decides the interrupt parent of node: node itself if
+ * it has an "interrupt-parent", else the closest ancestor which is an
+ * interrupt provider or has one.
+ */
+struct node *get_interrupt_parent_source(struct node *tree, struct node *node)
+{
+	if (get_property(node, "interrupt-parent"))
+		return node;
+	if (!node->parent)
+		return NULL;
+
+	irq_anchors(tree);
+	return node->parent->irqanchor;
+}
+
+/*
+ * Bring every index up to date, so that lookups no longer change
+ * anything and the tree can be searched from several threads at once.
+ */
+void index_tree(struct node *tree)
+{
+	label_table(tree);
+	phandle_table(tree);
+	index_lists(tree);
+	irq_anchors(tree);
 }
 
 struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
 {
-	struct node *child, *node;
+	struct phandle_table *tab;
 
 	if (!phandle_is_valid(phandle)) {
 		assert(generate_fixups);
 		return NULL;
 	}
 
-	if (tree->phandle == phandle) {
-		if (tree->deleted)
-			return NULL;
-		return tree;
-	}
+	if (tree->deleted)
+		return NULL;
 
-	for_each_child(tree, child) {
-		node = get_node_by_phandle(child, phandle);
-		if (node)
-			return node;
-	}
+	tab = phandle_table(tree);
+	if (!tab->size)
+		return NULL;
 
-	return NULL;
+	return *phandle_slot(tab, phandle);
+}
+
+void set_node_phandle(struct node *root, struct node *node, cell_t phandle)
+{
+	struct phandle_table *tab = root->phandletab;
+
+	node->phandle = phandle;
+
+	/* A stale index gets the new phandle when it is rebuilt */
+	if (tab && (tab->generation == tree_generation))
+		phandle_table_add(tab, node);
 }
 
 struct node *get_node_by_ref(struct node *tree, const char *ref)
@@ -616,29 +1251,41 @@ struct node *get_node_by_ref(struct node *tree, const char *ref)
 	return target;
 }
 
-cell_t get_node_phandle(struct node *root, struct node *node)
+static struct property *build_phandle_property(const char *name,
+					       cell_t phandle)
 {
-	static cell_t phandle = 1; /* FIXME: ick, static local */
 	struct data d = empty_data;
 
+	d = data_add_marker(d, TYPE_UINT32, NULL);
+	d = data_append_cell(d, phandle);
+
+	return build_property(xstrdup(name), d, NULL);
+}
+
+cell_t get_node_phandle(struct node *root, struct node *node)
+{
+	struct phandle_table *tab;
+	cell_t phandle;
+
 	if (phandle_is_valid(node->phandle))
 		return node->phandle;
 
-	while (get_node_by_phandle(root, phandle))
-		phandle++;
-
-	node->phandle = phandle;
+	/* Phandles are handed out in increasing order for each tree */
+	tab = phandle_table(root);
+	while (get_node_by_phandle(root, tab->next))
+		tab->next++;
+	phandle = tab->next++;
 
-	d = data_add_marker(d, TYPE_UINT32, NULL);
-	d = data_append_cell(d, phandle);
+	set_node_phandle(root, node, phandle);
 
 	if (!get_property(node, "linux,phandle")
 	    && (phandle_format & PHANDLE_LEGACY))
-		add_property(node, build_property("linux,phandle", d, NULL));
+		add_property(node, build_phandle_property("linux,phandle",
+							  phandle));
 
 	if (!get_property(node, "phandle")
 	    && (phandle_format & PHANDLE_EPAPR))
-		add_property(node, build_property("phandle", d, NULL));
+		add_property(node, build_phandle_property("phandle", phandle));
 
 	/* If the node *does* have a phandle property, we must
 	 * be dealing with a self-referencing phandle, which will be
@@ -647,6 +1294,23 @@ cell_t get_node_phandle(struct node *root, struct node *node)
 	return node->phandle;
 }
 
+cell_t get_max_phandle(struct node *tree)
+{
+	struct node *child;
+	cell_t max = 0, phandle;
+
+	if (phandle_is_valid(tree->phandle))
+		max = tree->phandle;
+
+	for_each_child(tree, child) {
+		phandle = get_max_phandle(child);
+		if (phandle > max)
+			max = phandle;
+	}
+
+	return max;
+}
+
 uint32_t guess_boot_cpuid(struct node *tree)
 {
 	struct node *cpus, *bootcpu;
@@ -747,6 +1411,7 @@ static void sort_properties(struct node *node)
 
 	qsort(tbl, n, sizeof(*tbl), cmp_prop);
 
+	name_index_free(&node->propindex);
 	node->proplist = tbl[0];
 	for (i = 0; i < (n-1); i++)
 		tbl[i]->next = tbl[i+1];
@@ -783,6 +1448,7 @@ static void sort_subnodes(struct node *node)
 
 	qsort(tbl, n, sizeof(*tbl), cmp_subnode);
 
+	name_index_free(&node->childindex);
 	node->children = tbl[0];
 	for (i = 0; i < (n-1); i++)
 		tbl[i]->next_sibling = tbl[i+1];
@@ -803,10 +1469,118 @@ static void sort_node(struct node *node)
 
 void sort_tree(struct dt_info *dti)
 {
+	tree_generation++;
+	label_generation++;
 	sort_reserve_entries(dti);
 	sort_node(dti->dt);
 }
 
+/*
+ * Once nothing can bring them back any more, deleted labels, properties
+ * and nodes are only dead weight every walk over the tree has to step
+ * over.  Unlink them, and free what was not taken from the arena.
+ */
+static void free_labels(struct label *labels)
+{
+	struct label *l;
+
+	for_each_label_withdel(labels, l)
+		free(l->label);
+}
+
+void free_property(struct property *prop)
+{
+	free_labels(prop->labels);
+	free(prop->name);
+	data_free(prop->val);
+}
+
+void free_node(struct node *node)
+{
+	struct property *prop;
+	struct node *child;
+
+	for_each_property_withdel(node, prop)
+		free_property(prop);
+	for_each_child_withdel(node, child)
+		free_node(child);
+
+	free_labels(node->labels);
+	free(node->name);
+	free(node->fullpath);
+	name_index_free(&node->propindex);
+	name_index_free(&node->childindex);
+	label_table_free(node);
+	phandle_table_free(node);
+}
+
+/*
+ * Free what a tree owns outside the arena: names, labels, property
+ * values and the indexes.  The objects themselves go with the arena.
+ */
+void free_dt_info(struct dt_info *dti)
+{
+	struct reserve_info *re;
+
+	for (re = dti->reservelist; re; re = re->next)
+		free_labels(re->labels);
+	free_node(dti->dt);
+}
+
+static void compact_labels(struct label **labels)
+{
+	while (*labels) {
+		if ((*labels)->deleted) {
+			free((*labels)->label);
+			*labels = (*labels)->next;
+		} else {
+			labels = &(*labels)->next;
+		}
+	}
+}
+
+static void compact_node(struct node *node)
+{
+	struct property **prop = &node->proplist;
+	struct node **child = &node->children;
+	bool changed = false;
+
+	compact_labels(&node->labels);
+
+	while (*prop) {
+		if ((*prop)->deleted) {
+			free_property(*prop);
+			*prop = (*prop)->next;
+			changed = true;
+		} else {
+			compact_labels(&(*prop)->labels);
+			prop = &(*prop)->next;
+		}
+	}
+	if (changed)
+		name_index_free(&node->propindex);
+
+	changed = false;
+	while (*child) {
+		if ((*child)->deleted) {
+			free_node(*child);
+			*child = (*child)->next_sibling;
+			changed = true;
+		} else {
+			compact_node(*child);
+			child = &(*child)->next_sibling;
+		}
+	}
+	if (changed)
+		name_index_free(&node->childindex);
+}
+
+void compact_tree(struct node *tree)
+{
+	tree_generation++;
+	compact_node(tree);
+}
+
 /* utility helper to avoid code duplication */
 static struct node *build_and_name_child_node(struct node *parent, char *name)
 {
@@ -872,7 +1646,7 @@ static void generate_label_tree_internal(struct dt_info *dti,
 			}
 
 			/* insert it */
-			p = build_property(l->label,
+			p = build_property(xstrdup(l->label),
 				data_copy_escape_string(node->fullpath,
 						strlen(node->fullpath)),
 				NULL);
@@ -1063,3 +1837,350 @@ void generate_local_fixups_tree(struct dt_info *dti, char *name)
 	generate_local_fixups_tree_internal(dti, build_root_node(dti->dt, name),
 					    dti->dt);
 }
+
+/*
+ * Record the highest phandle of the tree in a root property, which lets
+ * libfdt find it without a scan of the whole blob.
+ */
+void generate_max_phandle_hint(struct dt_info *dti)
+{
+	struct property *prop;
+	struct data d = empty_data;
+
+	d = data_add_marker(d, TYPE_UINT32, NULL);
+	d = data_append_cell(d, get_max_phandle(dti->dt));
+
+	prop = get_property(dti->dt, FDT_MAX_PHANDLE_HINT);
+	if (prop) {
+		data_free(prop->val);
+		prop->val = d;
+	} else {
+		add_property(dti->dt,
+			     build_property(xstrdup(FDT_MAX_PHANDLE_HINT),
+					    d, NULL));
+	}
+}
+
+/*
+ * A tree read from a blob has no labels, but may still export its nodes
+ * through __symbols__.  Turn those back into labels.
+ */
+void add_symbol_labels(struct node *dt)
+{
+	struct node *symbols = get_subnode(dt, "__symbols__");
+	struct property *prop;
+	struct node *node;
+
+	if (!symbols)
+		return;
+
+	for_each_property(symbols, prop) {
+		if (!data_is_one_string(prop->val) || (prop->val.val[0] != '/'))
+			continue;
+
+		node = get_node_by_path(dt, prop->val.val);
+		if (node)
+			add_node_label(node, xstrdup(prop->name));
+	}
+}
+
+/*
+ * Overlay merging
+ *
+ * Overlays are merged straight into the live tree, and the references
+ * they make are left as markers for the checks to resolve along with
+ * those of the base tree.  A compiled overlay has its __fixups__ and
+ * __local_fixups__ turned back into such markers first.
+ */
+
+static char *node_path(struct node *node)
+{
+	char *parent, *path;
+
+	if (!node->parent)
+		return xstrdup("/");
+
+	parent = node_path(node->parent);
+	path = join_path(parent, node->name);
+	free(parent);
+
+	return path;
+}
+
+static void add_phandle_ref(struct property *prop, unsigned int offset,
+			    const char *ref)
+{
+	struct marker *m, **mp = &prop->val.markers;
+
+	while (*mp && ((*mp)->offset <= offset))
+		mp = &(*mp)->next;
+
+	m = arena_alloc(sizeof(*m));
+	memset(m, 0, sizeof(*m));
+	m->type = REF_PHANDLE;
+	m->offset = offset;
+	m->ref = xstrdup(ref);
+	m->next = *mp;
+	*mp = m;
+}
+
+/*
+ * The checks only give nodes their phandles later on, so while an
+ * overlay is merged each node is lent the phandle of its property, for
+ * numeric references to be found through the phandle index.
+ */
+static void lend_phandles(struct node *root, struct node *node)
+{
+	struct property *prop;
+	struct node *child;
+
+	prop = get_property(node, "phandle");
+	if (!prop)
+		prop = get_property(node, "linux,phandle");
+	if (prop && (prop->val.len == sizeof(cell_t))
+	    && phandle_is_valid(propval_cell(prop)))
+		set_node_phandle(root, node, propval_cell(prop));
+
+	for_each_child(node, child)
+		lend_phandles(root, child);
+}
+
+static void return_phandles(struct node *node)
+{
+	struct node *child;
+
+	node->phandle = 0;
+	for_each_child_withdel(node, child)
+		return_phandles(child);
+}
+
+static struct node *get_lent_phandle(struct node *tree, cell_t phandle)
+{
+	if (!phandle_is_valid(phandle))
+		return NULL;
+
+	return get_node_by_phandle(tree, phandle);
+}
+
+static struct node *find_fragment_target(struct dt_info *dti,
+					 struct node *fragment)
+{
+	struct property *prop;
+	struct marker *m;
+
+	prop = get_property(fragment, "target");
+	if (prop) {
+		m = prop->val.markers;
+		for_each_marker_of_type(m, REF_PHANDLE)
+			break;
+
+		if (m)
+			return get_node_by_ref(dti->dt, m->ref);
+		else if (prop->val.len == sizeof(cell_t))
+			return get_lent_phandle(dti->dt, propval_cell(prop));
+	} else {
+		prop = get_property(fragment, "target-path");
+		if (prop && data_is_one_string(prop->val))
+			return get_node_by_ref(dti->dt, prop->val.val);
+	}
+
+	return NULL;
+}
+
+static struct node *get_fragment_target(struct dt_info *dti,
+					struct node *fragment,
+					const char *name)
+{
+	struct node *target = find_fragment_target(dti, fragment);
+
+	if (!target)
+		die("%s: Can't find the target of /%s\n", name, fragment->name);
+
+	return target;
+}
+
+static void fixups_to_markers(struct node *dt, const char *name)
+{
+	struct node *fixups = get_subnode(dt, "__fixups__");
+	struct property *fixup, *prop;
+	struct node *node;
+	char *entry, *propname, *offset, *end;
+	unsigned int i, len;
+	unsigned long off;
+
+	if (!fixups)
+		return;
+
+	for_each_property(fixups, fixup) {
+		for (i = 0; i < fixup->val.len; i += len + 1) {
+			len = strnlen(fixup->val.val + i, fixup->val.len - i);
+			entry = xstrndup(fixup->val.val + i, len);
+
+			/* Each entry is <path>:<property>:<offset> */
+			propname = strchr(entry, ':');
+			offset = strrchr(entry, ':');
+			if (!propname || (offset == propname))
+				die("%s: Malformed fixup \"%s\"\n", name, entry);
+			*propname++ = '\0';
+			*offset++ = '\0';
+
+			node = get_node_by_path(dt, entry);
+			prop = node ? get_property(node, propname) : NULL;
+			off = strtoul(offset, &end, 10);
+			if (!prop || !*offset || *end
+			    || ((off + sizeof(cell_t)) > prop->val.len))
+				die("%s: Bad fixup for %s in %s:%s\n", name,
+				    fixup->name, entry, propname);
+
+			add_phandle_ref(prop, off, fixup->name);
+			free(entry);
+		}
+	}
+
+	delete_node(fixups);
+}
+
+/* Path a node of the overlay will have once its fragment is merged */
+static char *merged_path(struct dt_info *dti, struct node *node,
+			 const char *name)
+{
+	struct node *overlay = node;
+	char *target, *path, *rel;
+
+	while (overlay->parent && overlay->parent->parent
+	       && !streq(overlay->name, "__overlay__"))
+		overlay = overlay->parent;
+
+	if (!overlay->parent || !overlay->parent->parent)
+		die("%s: Local reference to /%s outside of any fragment\n",
+		    name, node->name);
+
+	target = node_path(get_fragment_target(dti, overlay->parent, name));
+	path = node_path(node);
+	rel = node_path(overlay);
+
+	if (!streq(path, rel)) {
+		char *merged;
+
+		xasprintf(&merged, "%s%s", streq(target, "/") ? "" : target,
+			  path + strlen(rel));
+		free(target);
+		target = merged;
+	}
+	free(rel);
+	free(path);
+
+	return target;
+}
+
+static void local_fixups_to_markers(struct dt_info *dti, struct node *dt,
+				    struct node *lfn, struct node *node,
+				    const char *name)
+{
+	struct property *fixup, *prop;
+	struct node *child, *refnode;
+	unsigned int i, offset;
+	char *ref;
+
+	for_each_property(lfn, fixup) {
+		prop = get_property(node, fixup->name);
+		if (!prop || (fixup->val.len % sizeof(cell_t)))
+			die("%s: Bad local fixup for %s\n", name, fixup->name);
+
+		for (i = 0; i < fixup->val.len; i += sizeof(cell_t)) {
+			offset = dtb_ld32(fixup->val.val + i);
+			if ((offset + sizeof(cell_t)) > prop->val.len)
+				die("%s: Bad local fixup for %s\n", name,
+				    fixup->name);
+
+			refnode = get_lent_phandle(dt,
+					dtb_ld32(prop->val.val + offset));
+			if (!refnode)
+				die("%s: Local fixup for %s to a missing node\n",
+				    name, fixup->name);
+
+			ref = merged_path(dti, refnode, name);
+			add_phandle_ref(prop, offset, ref);
+			free(ref);
+		}
+	}
+
+	for_each_child(lfn, child) {
+		struct node *n = get_subnode(node, child->name);
+
+		if (!n)
+			die("%s: Bad local fixup node %s\n", name, child->name);
+		local_fixups_to_markers(dti, dt, child, n, name);
+	}
+}
+
+/* Phandles of a compiled overlay are replaced by the markers */
+static void delete_phandles(struct node *node)
+{
+	struct node *child;
+
+	delete_property_by_name(node, "phandle");
+	delete_property_by_name(node, "linux,phandle");
+
+	for_each_child(node, child)
+		delete_phandles(child);
+}
+
+void merge_overlay(struct dt_info *dti, struct dt_info *overlay,
+		   const char *name)
+{
+	struct node *dt = overlay->dt, *lfn, *fragment, *ov, **np;
+	struct node **targets, *target;
+	unsigned int n = 0, i;
+
+	lend_phandles(dti->dt, dti->dt);
+	lend_phandles(dt, dt);
+
+	if (!(overlay->dtsflags & DTSF_PLUGIN)) {
+		add_symbol_labels(dt);
+		delete_node_by_name(dt, "__symbols__");
+
+		fixups_to_markers(dt, name);
+
+		lfn = get_subnode(dt, "__local_fixups__");
+		if (lfn) {
+			local_fixups_to_markers(dti, dt, lfn, dt, name);
+			delete_node(lfn);
+		}
+
+		delete_phandles(dt);
+	}
+
+	/* Find the targets while no merge has yet moved a phandle... */
+	for_each_child(dt, fragment)
+		n++;
+	targets = xmalloc((n + 1) * sizeof(*targets));
+	i = 0;
+	for_each_child(dt, fragment)
+		targets[i++] = find_fragment_target(dti, fragment);
+
+	i = 0;
+	for_each_child(dt, fragment) {
+		target = targets[i++];
+		ov = get_subnode(fragment, "__overlay__");
+		if (!ov)
+			continue;
+
+		/* ...except those an earlier fragment adds or deletes */
+		if (!target || target->deleted)
+			target = get_fragment_target(dti, fragment, name);
+
+		/* merge_nodes() empties the __overlay__ node */
+		for (np = &fragment->children; *np != ov; np = &(*np)->next_sibling)
+			;
+		*np = ov->next_sibling;
+		name_index_free(&fragment->childindex);
+
+		merge_nodes(target, ov);
+	}
+	free(targets);
+	free_dt_info(overlay);
+
+	return_phandles(dti->dt);
+	tree_generation++;
+}
@@ -29,7 +29,7 @@ static char *get_dirname(const char *path)
 
 	if (slash) {
 		int len = slash - path;
-		char *dir = xmalloc(len + 1);
+		char *dir = arena_alloc(len + 1);
 
 		memcpy(dir, path, len);
 		dir[len] = '\0';
@@ -48,6 +48,7 @@ static void set_initial_path(char *fname)
 {
 	int i, len = strlen(fname);
 
+	free(initial_path);
 	xasprintf(&initial_path, "%s", fname);
 	initial_pathlen = 0;
 	for (i = 0; i != len; i++)
@@ -169,17 +170,51 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep)
 	return f;
 }
 
+FILE *srcfile_include_open(const char *fname, const char *dir, bool angled,
+			   char **fullnamep)
+{
+	struct search_path *node;
+	char *fullname = NULL;
+	FILE *f = NULL;
+
+	if (!angled || (fname[0] == '/'))
+		fullname = try_open(dir, fname, &f);
+
+	for (node = search_path_head; !f && node; node = node->next)
+		fullname = try_open(node->dirname, fname, &f);
+
+	if (!f)
+		return NULL;
+
+	if (depfile)
+		fprintf(depfile, " %s", fullname);
+
+	*fullnamep = fullname;
+	return f;
+}
+
 void srcfile_push(const char *fname)
+{
+	char *fullname;
+	FILE *f;
+
+	f = srcfile_relative_open(fname, &fullname);
+	srcfile_push_file(f, fullname);
+}
+
+void srcfile_push_file(FILE *f, char *fullname)
 {
 	struct srcfile_state *srcfile;
 
 	if (srcfile_depth++ >= MAX_SRCFILE_DEPTH)
 		die("Includes nested too deeply");
 
-	srcfile = xmalloc(sizeof(*srcfile));
+	srcfile = arena_alloc(sizeof(*srcfile));
 
-	srcfile->f = srcfile_relative_open(fname, &srcfile->name);
+	srcfile->f = f;
+	srcfile->name = arena_strdup(fullname);
 	srcfile->dir = get_dirname(srcfile->name);
+	free(fullname);
 	srcfile->prev = current_srcfile;
 
 	srcfile->lineno = 1;
@@ -187,8 +222,11 @@ void srcfile_push(const char *fname)
 
 	current_srcfile = srcfile;
 
-	if (srcfile_depth == 1)
+	/* Each input's own line markers may name where it came from */
+	if (srcfile_depth == 1) {
+		initial_cpp = true;
 		set_initial_path(srcfile->name);
+	}
 }
 
 bool srcfile_pop(void)
@@ -198,16 +236,15 @@ bool srcfile_pop(void)
 	assert(srcfile);
 
 	current_srcfile = srcfile->prev;
+	srcfile_depth--;
 
 	if (fclose(srcfile->f))
 		die("Error closing \"%s\": %s\n", srcfile->name,
 		    strerror(errno));
 
-	/* FIXME: We allow the srcfile_state structure to leak,
-	 * because it could still be referenced from a location
-	 * variable being carried through the parser somewhere.  To
-	 * fix this we could either allocate all the files from a
-	 * table, or use a pool allocator. */
+	/* The srcfile_state structure, which could still be referenced
+	 * from a location variable being carried through the parser
+	 * somewhere, is left to the arena along with its names. */
 
 	return current_srcfile ? true : false;
 }
@@ -259,12 +296,12 @@ srcpos_copy(struct srcpos *pos)
 	if (!pos)
 		return NULL;
 
-	pos_new = xmalloc(sizeof(struct srcpos));
+	pos_new = arena_alloc(sizeof(struct srcpos));
 	assert(pos->next == NULL);
 	memcpy(pos_new, pos, sizeof(struct srcpos));
 
 	/* allocate without free */
-	srcfile_state = xmalloc(sizeof(struct srcfile_state));
+	srcfile_state = arena_alloc(sizeof(struct srcfile_state));
 	memcpy(srcfile_state, pos->file, sizeof(struct srcfile_state));
 	pos_new->file = srcfile_state;
 
@@ -396,11 +433,12 @@ void srcpos_error(struct srcpos *pos, const char *prefix,
 
 void srcpos_set_line(char *f, int l)
 {
-	current_srcfile->name = f;
+	current_srcfile->name = arena_strdup(f);
+	free(f);
 	current_srcfile->lineno = l;
 
 	if (initial_cpp) {
 		initial_cpp = false;
-		set_initial_path(f);
+		set_initial_path(current_srcfile->name);
 	}
 }
@@ -42,7 +42,32 @@ extern struct srcfile_state *current_srcfile; /* = NULL */
  */
 FILE *srcfile_relative_open(const char *fname, char **fullnamep);
 
+/**
+ * Open a file named by a preprocessor #include
+ *
+ * "file" includes are looked for in the including file's directory, then
+ * the search path; <file> includes only on the search path.
+ *
+ * @param fname		Filename to search
+ * @param dir		Directory of the including file, or NULL for the
+ *			current directory
+ * @param angled	true for a <file> include
+ * @param fullnamep	Set to the allocated filename of the file that was
+ *			opened, which the caller must free
+ * @return pointer to opened FILE, or NULL if there is no such file
+ */
+FILE *srcfile_include_open(const char *fname, const char *dir, bool angled,
+			   char **fullnamep);
+
 void srcfile_push(const char *fname);
+
+/**
+ * Read from an already open stream, as if it were the named file
+ *
+ * @param f		Stream to read, closed by srcfile_pop()
+ * @param fullname	Allocated name of the file, which is taken over
+ */
+void srcfile_push_file(FILE *f, char *fullname);
 bool srcfile_pop(void);
 
 /**
@@ -0,0 +1,15 @@
+#ifndef CPP_H
+#define CPP_H
+
+#define SZ_4K			0x1000
+#define IRQ_TYPE_LEVEL_HIGH	4
+#define GIC_SPI			0
+
+/* Function-like macros, with # and ## */
+#define REG(base, size)		<(base) (size)>
+#define IRQ_TYPE(type)		IRQ_TYPE_##type
+#define STR(x)			#x
+#define XSTR(x)			STR(x)
+#define LIST(first, ...)	first, ## __VA_ARGS__
+
+#endif
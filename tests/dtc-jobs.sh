@@ -0,0 +1,32 @@
+#! /bin/sh
+
+# Check that running the checks on several threads reports just the same
+
+SRCDIR=`dirname "$0"`
+. "$SRCDIR/testutils.sh"
+
+JOBS="$1"
+shift
+
+LOG1=tmp.log1.$$
+LOGN=tmp.logn.$$
+rm -f $LOG1 $LOGN
+trap "rm -f $LOG1 $LOGN" 0
+
+verbose_run_log "$LOG1" $VALGRIND "$DTC" -j 1 -o /dev/null "$@"
+ret1="$?"
+FAIL_IF_SIGNAL $ret1
+
+verbose_run_log "$LOGN" $VALGRIND "$DTC" -j "$JOBS" -o /dev/null "$@"
+retn="$?"
+FAIL_IF_SIGNAL $retn
+
+if [ "$retn" != "$ret1" ]; then
+    FAIL "Returned error code $retn instead of $ret1"
+fi
+
+if ! cmp -s $LOG1 $LOGN; then
+    FAIL "Different diagnostics with $JOBS jobs"
+fi
+
+PASS
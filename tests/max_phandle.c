@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for the max phandle hint
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+
+#define CHECK(code) \
+	{ \
+		int err = (code); \
+		if (err) \
+			FAIL(#code ": %s", fdt_strerror(err)); \
+	}
+
+#define FDT_COPY_SIZE	(16 * 1024)
+
+static void *copy_dt(const void *fdt)
+{
+	void *copy = xmalloc(FDT_COPY_SIZE);
+
+	CHECK(fdt_open_into(fdt, copy, FDT_COPY_SIZE));
+
+	return copy;
+}
+
+static bool has_hint(const void *fdt)
+{
+	return fdt_getprop(fdt, 0, FDT_MAX_PHANDLE_HINT, NULL) != NULL;
+}
+
+static void add_hint(void *fdt)
+{
+	uint32_t max;
+
+	CHECK(fdt_find_max_phandle(fdt, &max));
+	CHECK(fdt_setprop_u32(fdt, 0, FDT_MAX_PHANDLE_HINT, max));
+}
+
+/* Compare the answer given through the hint with a full scan */
+static void check_max(const void *fdt, bool hint, const char *what)
+{
+	uint32_t max, scanned, next;
+	void *copy;
+
+	if (has_hint(fdt) != hint)
+		FAIL("%s: max phandle hint %s", what,
+		     hint ? "was dropped" : "was kept");
+
+	CHECK(fdt_find_max_phandle(fdt, &max));
+
+	copy = copy_dt(fdt);
+	if (hint)
+		CHECK(fdt_nop_property(copy, 0, FDT_MAX_PHANDLE_HINT));
+	CHECK(fdt_find_max_phandle(copy, &scanned));
+	free(copy);
+
+	if (max != scanned)
+		FAIL("%s: max phandle is 0x%x instead of 0x%x", what,
+		     max, scanned);
+
+	CHECK(fdt_generate_phandle(fdt, &next));
+	if (next != scanned + 1)
+		FAIL("%s: generated phandle 0x%x instead of 0x%x", what,
+		     next, scanned + 1);
+}
+
+static int node_with_phandle(const void *fdt, uint32_t phandle)
+{
+	int node = fdt_node_offset_by_phandle(fdt, phandle);
+
+	if (node < 0)
+		FAIL("fdt_node_offset_by_phandle(0x%x): %s", phandle,
+		     fdt_strerror(node));
+	return node;
+}
+
+int main(int argc, char *argv[])
+{
+	void *base, *overlay, *fdt, *fdto;
+	uint32_t max;
+	int node;
+
+	test_init(argc, argv);
+	if (argc != 3)
+		CONFIG("Usage: %s <base dtb> <overlay dtb>", argv[0]);
+
+	base = load_blob(argv[1]);
+	overlay = load_blob(argv[2]);
+	fdt = copy_dt(base);
+	check_max(fdt, true, "initial");
+
+	/* A higher phandle raises the hint */
+	CHECK(fdt_find_max_phandle(fdt, &max));
+	node = fdt_add_subnode(fdt, 0, "extra-node");
+	if (node < 0)
+		FAIL("fdt_add_subnode(): %s", fdt_strerror(node));
+	CHECK(fdt_setprop_u32(fdt, node, "phandle", max + 10));
+	check_max(fdt, true, "setprop");
+
+	/* A lower one leaves it alone */
+	CHECK(fdt_setprop_u32(fdt, node, "linux,phandle", 1));
+	check_max(fdt, true, "lower setprop");
+	CHECK(fdt_delprop(fdt, node, "linux,phandle"));
+	check_max(fdt, true, "lower delprop");
+
+	/* Lowering the highest phandle drops it */
+	CHECK(fdt_setprop_inplace_u32(fdt, node, "phandle", max + 1));
+	check_max(fdt, false, "setprop_inplace");
+
+	add_hint(fdt);
+	node = fdt_path_offset(fdt, "/extra-node");
+	CHECK(fdt_delprop(fdt, node, "phandle"));
+	check_max(fdt, false, "delprop");
+
+	add_hint(fdt);
+	CHECK(fdt_nop_property(fdt, node_with_phandle(fdt, max), "phandle"));
+	check_max(fdt, false, "nop_property");
+
+	/* As does removing the node which has it */
+	add_hint(fdt);
+	CHECK(fdt_find_max_phandle(fdt, &max));
+	CHECK(fdt_del_node(fdt, node_with_phandle(fdt, max)));
+	check_max(fdt, false, "del_node");
+
+	add_hint(fdt);
+	CHECK(fdt_find_max_phandle(fdt, &max));
+	CHECK(fdt_nop_node(fdt, node_with_phandle(fdt, max)));
+	check_max(fdt, false, "nop_node");
+
+	/* Other nodes can go without a new scan */
+	add_hint(fdt);
+	CHECK(fdt_del_node(fdt, fdt_path_offset(fdt, "/extra-node")));
+	check_max(fdt, true, "del_node of another node");
+	free(fdt);
+
+	/* An overlay keeps it up to date through its phandles */
+	fdt = copy_dt(base);
+	fdto = copy_dt(overlay);
+	CHECK(fdt_overlay_apply(fdt, fdto));
+	check_max(fdt, true, "overlay");
+	free(fdto);
+	free(fdt);
+
+	PASS();
+}
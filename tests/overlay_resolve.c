@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * libfdt - Flat Device Tree manipulation
+ *	Testcase for fdt_overlay_resolve()
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libfdt.h>
+
+#include "tests.h"
+
+#define CHECK(code) \
+	{ \
+		int err = (code); \
+		if (err) \
+			FAIL(#code ": %s", fdt_strerror(err)); \
+	}
+
+#define FDT_COPY_SIZE	(8 * 1024)
+
+static void *copy_dt(const void *fdt)
+{
+	void *copy = xmalloc(FDT_COPY_SIZE);
+
+	CHECK(fdt_open_into(fdt, copy, FDT_COPY_SIZE));
+
+	return copy;
+}
+
+static void check_same_tree(void *fdt1, void *fdt2, const char *what)
+{
+	CHECK(fdt_pack(fdt1));
+	CHECK(fdt_pack(fdt2));
+
+	if ((fdt_totalsize(fdt1) != fdt_totalsize(fdt2))
+	    || memcmp(fdt1, fdt2, fdt_totalsize(fdt1)) != 0)
+		FAIL("%s: resolved overlay gives a different tree", what);
+}
+
+/* Apply a plain and a resolved overlay to copies of base and compare */
+static void check_apply(const void *base, const void *overlay,
+			const void *resolved, const char *what)
+{
+	void *expected, *fdt, *fdto;
+
+	expected = copy_dt(base);
+	fdto = copy_dt(overlay);
+	CHECK(fdt_overlay_apply(expected, fdto));
+	free(fdto);
+
+	fdt = copy_dt(base);
+	fdto = copy_dt(resolved);
+	CHECK(fdt_overlay_apply(fdt, fdto));
+	free(fdto);
+
+	check_same_tree(expected, fdt, what);
+	free(expected);
+	free(fdt);
+}
+
+int main(int argc, char *argv[])
+{
+	void *base, *overlay, *resolved, *fdto, *other;
+	uint32_t max;
+	int ret, node;
+
+	test_init(argc, argv);
+	if (argc != 3)
+		CONFIG("Usage: %s <base dtb> <overlay dtb>", argv[0]);
+
+	base = load_blob(argv[1]);
+	overlay = load_blob(argv[2]);
+
+	resolved = copy_dt(overlay);
+	CHECK(fdt_overlay_resolve(base, resolved));
+	if (fdt_path_offset(resolved, "/__resolved__") < 0)
+		FAIL("No /__resolved__ node in the resolved overlay");
+
+	fdto = copy_dt(resolved);
+	ret = fdt_overlay_resolve(base, fdto);
+	if (ret != -FDT_ERR_EXISTS)
+		FAIL("Resolving twice returned %d instead of %d",
+		     ret, -FDT_ERR_EXISTS);
+	free(fdto);
+
+	check_apply(base, overlay, resolved, "same base");
+
+	/*
+	 * A base with a higher phandle no longer matches the digest, and
+	 * must get the overlay phandles shifted once more.
+	 */
+	other = copy_dt(base);
+	CHECK(fdt_find_max_phandle(other, &max));
+	node = fdt_add_subnode(other, 0, "extra-node");
+	if (node < 0)
+		FAIL("fdt_add_subnode(): %s", fdt_strerror(node));
+	CHECK(fdt_setprop_u32(other, node, "phandle", max + 10));
+
+	check_apply(other, overlay, resolved, "different base");
+
+	PASS();
+}
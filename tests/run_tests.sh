@@ -179,6 +179,54 @@ check_align () {
     )
 }
 
+# $1: file which should be the smaller one
+# $2: file to compare with
+check_smaller () {
+    shorten_echo "check_smaller $@:	"
+    local size=$($STATSZ "$1")
+    local other=$($STATSZ "$2")
+    (
+	if [ "$size" -lt "$other" ] ;then
+	    PASS
+	else
+	    FAIL "Output size $size is not below $other"
+	fi
+    )
+}
+
+# $1: check which should be in the --check-stats table
+# $2...: dtc arguments
+check_stats () {
+    local check="$1"
+    shift
+    shorten_echo "check_stats $check $@:	"
+    (
+	stats="$($DTC --check-stats -o /dev/null "$@" 2>&1)"
+	if [ "$(echo "$stats" | grep -c '^check ')" -ne 1 ]; then
+	    FAIL "Not exactly one statistics table"
+	elif echo "$stats" | grep -q "^$check "; then
+	    PASS
+	else
+	    FAIL "No statistics for $check"
+	fi
+    )
+}
+
+# $1: format for --time-report
+# $2...: dtc arguments
+time_report () {
+    local format="$1"
+    shift
+    shorten_echo "time_report $format $@:	"
+    (
+	if $DTC --time-report "$format" -o /dev/null "$@" 2>&1 | grep -q "checks"; then
+	    PASS
+	else
+	    FAIL "No time report"
+	fi
+    )
+}
+
 run_dtc_test () {
     printf "dtc $*:	"
     base_run_test wrap_test $VALGRIND $DTC "$@"
@@ -319,6 +367,16 @@ dtc_overlay_tests () {
     run_test overlay overlay_base.test.dtb overlay_overlay.test.dtb
     run_test overlay overlay_base_no_symbols.test.dtb overlay_overlay_bypath.test.dtb
 
+    # Check overlays resolved against their base apply the same way
+    run_dtc_test -@ -I dts -O dtb -o overlay_overlay_symbols.test.dtb "$SRCDIR/overlay_overlay.dts"
+    run_test overlay_resolve overlay_base.test.dtb overlay_overlay.test.dtb
+    run_test overlay_resolve overlay_base.test.dtb overlay_overlay_symbols.test.dtb
+    run_test overlay_resolve overlay_base_no_symbols.test.dtb overlay_overlay_bypath.test.dtb
+
+    # Check the max phandle hint stays in step with the tree
+    run_dtc_test -@ -M -I dts -O dtb -o overlay_base_max_phandle.test.dtb "$SRCDIR/overlay_base.dts"
+    run_test max_phandle overlay_base_max_phandle.test.dtb overlay_overlay.test.dtb
+
     # test plugin source to dtb and back
     run_dtc_test -I dtb -O dts -o overlay_overlay_decompile.test.dts overlay_overlay.test.dtb
     run_dtc_test -I dts -O dtb -o overlay_overlay_decompile.test.dtb overlay_overlay_decompile.test.dts
@@ -568,11 +626,45 @@ dtc_tests () {
 	run_test phandle_format dtc_references.test.$f.dtb $f
     done
 
+    # Check tail sharing in the strings block
+    run_dtc_test -I dts -O dtb -o pack_strings.test.dtb "$SRCDIR/pack_strings.dts"
+    run_dtc_test -P -I dts -O dtb -o pack_strings.packed.test.dtb "$SRCDIR/pack_strings.dts"
+    run_test dtbs_equal_ordered pack_strings.test.dtb pack_strings.packed.test.dtb
+    check_smaller pack_strings.packed.test.dtb pack_strings.test.dtb
+    run_dtc_test -P -I dts -O dtb -H both -o dtc_references.test.packed.dtb "$SRCDIR/references.dts"
+    run_test references dtc_references.test.packed.dtb
+    run_test phandle_format dtc_references.test.packed.dtb both
+
     run_dtc_test -I dts -O dtb -o multilabel.test.dtb "$SRCDIR/multilabel.dts"
     run_test references multilabel.test.dtb
 
     run_dtc_test -I dts -O dtb -o label_repeated.test.dtb "$SRCDIR/label_repeated.dts"
 
+    # Check a tree patched through thousands of labels, as a board file
+    # patches the SoC it includes, comes out as if it were written whole
+    {
+	echo '/dts-v1/; / { #address-cells = <1>; #size-cells = <0>;'
+	i=0
+	while [ $i -lt 5000 ]; do
+	    echo "n$i: node@$i { reg = <$i>; status = \"disabled\"; };"
+	    i=$((i + 1))
+	done
+	echo '};'
+	i=0
+	while [ $i -lt 5000 ]; do
+	    echo "&n$i { status = \"okay\"; };"
+	    i=$((i + 1))
+	done
+    } > label_overrides.test.dts
+    sed -e '/^&/d' -e 's/"disabled"/"okay"/' label_overrides.test.dts \
+	> label_overrides-cmp.test.dts
+    run_dtc_test -I dts -O dtb -o label_overrides.test.dtb \
+	label_overrides.test.dts
+    run_dtc_test -I dts -O dtb -o label_overrides-cmp.test.dtb \
+	label_overrides-cmp.test.dts
+    run_test dtbs_equal_ordered label_overrides.test.dtb \
+	label_overrides-cmp.test.dtb
+
     run_dtc_test -I dts -O dtb -o dtc_comments.test.dtb "$SRCDIR/comments.dts"
     run_dtc_test -I dts -O dtb -o dtc_comments-cmp.test.dtb "$SRCDIR/comments-cmp.dts"
     run_test dtbs_equal_ordered dtc_comments.test.dtb dtc_comments-cmp.test.dtb
@@ -581,6 +673,68 @@ dtc_tests () {
     run_dtc_test -I dts -O dtb -o includes.test.dtb "$SRCDIR/include0.dts"
     run_test dtbs_equal_ordered includes.test.dtb test_tree1.dtb
 
+    # Check the built-in preprocessor
+    run_dtc_test --cpp --define VENDOR=acme -i "$SRCDIR" -I dts -O dtb \
+	-o cpp.test.dtb "$SRCDIR/cpp.dts"
+    run_dtc_test -I dts -O dtb -o cpp-cmp.test.dtb "$SRCDIR/cpp-cmp.dts"
+    run_test dtbs_equal_ordered cpp.test.dtb cpp-cmp.test.dtb
+    run_wrap_error_test $DTC --cpp --define VENDOR=acme -I dts -O dtb \
+	-o /dev/null "$SRCDIR/cpp.dts"
+    run_wrap_error_test $DTC --cpp --define VENDOR=acme --define CPP_FAIL \
+	-i "$SRCDIR" -I dts -O dtb -o /dev/null "$SRCDIR/cpp.dts"
+
+    # Check the include cache gives the tree a full parse does, both
+    # when it is filled and when it is read
+    rm -rf include-cache
+    run_dtc_test --cpp -I dts -O dts -T -T -o include-cache.test.dts \
+	"$SRCDIR/include-cache.dts"
+    for pass in fill read; do
+	run_dtc_test --include-cache include-cache -I dts -O dts -T -T \
+	    -o include-cache.$pass.test.dts "$SRCDIR/include-cache.dts"
+	run_wrap_test cmp include-cache.test.dts include-cache.$pass.test.dts
+    done
+    run_wrap_test test -n "$(ls include-cache)"
+
+    # Check --batch compiles each input as a run of its own would, and
+    # carries on past one which fails
+    batch_trees="test_tree1 include-cache overlay_overlay"
+    for tree in bad-octal-literal $batch_trees; do
+	echo "$SRCDIR/$tree.dts batch_$tree.test.dtb"
+    done > batch.test.list
+    run_wrap_error_test $DTC --cpp -j2 --batch batch.test.list
+    for tree in $batch_trees; do
+	run_dtc_test --cpp -o single_$tree.test.dtb "$SRCDIR/$tree.dts"
+	run_wrap_test cmp single_$tree.test.dtb batch_$tree.test.dtb
+    done
+
+    # Check inputs which include the same file, compiled one after
+    # another by a worker sharing it between them, each come out as
+    # they do on their own
+    shared_trees="include-cache include-cache-other include-cache"
+    n=0
+    for tree in $shared_trees; do
+	n=$((n + 1))
+	echo "$SRCDIR/$tree.dts shared_$n.test.dts"
+    done > shared.test.list
+    run_dtc_test --cpp -O dts -j1 --batch shared.test.list
+    n=0
+    for tree in $shared_trees; do
+	n=$((n + 1))
+	run_dtc_test --cpp -O dts -o unshared_$n.test.dts "$SRCDIR/$tree.dts"
+	run_wrap_test cmp unshared_$n.test.dts shared_$n.test.dts
+    done
+
+    # Check a compile frees everything it allocated (make checkm)
+    if [ -n "$VALGRIND" ]; then
+	leakcheck="$VALGRIND --leak-check=full --errors-for-leak-kinds=definite"
+	run_wrap_test $leakcheck $DTC -@ -I dts -O dtb -o leaks.test.dtb \
+	    "$SRCDIR/overlay_base.dts"
+	run_wrap_test $leakcheck $DTC -I dtb -O dtb -o leaks_merged.test.dtb \
+	    leaks.test.dtb "$SRCDIR/overlay_overlay.dts"
+	run_wrap_test $leakcheck $DTC --cpp -I dts -O dts -o leaks.test.dts \
+	    "$SRCDIR/include-cache.dts"
+    fi
+
     # Check /incbin/ directive
     run_dtc_test -I dts -O dtb -o incbin.test.dtb "$SRCDIR/incbin.dts"
     run_test incbin "$SRCDIR/incbin.bin" incbin.test.dtb
@@ -696,6 +850,11 @@ dtc_tests () {
 
     run_dtc_test -I dts -O dts -o delete_reinstate_multilabel.dts.test.dts "$SRCDIR/delete_reinstate_multilabel.dts"
     run_wrap_test cmp delete_reinstate_multilabel.dts.test.dts "$SRCDIR/delete_reinstate_multilabel_ref.dts"
+    run_dtc_test -@ -I dts -O dts -o delete_reinstate_multilabel.dts.symbols.test.dts "$SRCDIR/delete_reinstate_multilabel.dts"
+    run_wrap_test cmp delete_reinstate_multilabel.dts.symbols.test.dts "$SRCDIR/delete_reinstate_multilabel_ref.dts"
+
+    run_dtc_test -I dts -O dts -o wide_node_merge.dts.test.dts "$SRCDIR/wide_node_merge.dts"
+    run_wrap_test cmp wide_node_merge.dts.test.dts "$SRCDIR/wide_node_merge_ref.dts"
 
     # Check some checks
     check_tests "$SRCDIR/dup-nodename.dts" duplicate_node_names
@@ -758,6 +917,17 @@ dtc_tests () {
     check_tests "$SRCDIR/unit-addr-simple-bus-reg-mismatch.dts" simple_bus_reg
     check_tests "$SRCDIR/unit-addr-simple-bus-compatible.dts" simple_bus_reg
 
+    check_stats duplicate_node_names -I dts -O dtb "$SRCDIR/test_tree1.dts"
+    check_stats gpios_property -f -I dts -O dtb "$SRCDIR/bad-gpio.dts"
+    check_stats duplicate_node_names -D "$SRCDIR/diff_old.dts" -O dtb \
+	"$SRCDIR/diff_new.dts"
+    time_report text -I dts -O dtb "$SRCDIR/test_tree1.dts"
+    time_report json -@ -s -I dts -O dtb "$SRCDIR/test_tree1.dts"
+
+    for tree in bad-graph.dts bad-interrupt-map.dts bad-string-props.dts \
+		unit-addr-unique.dts bad-phandle-cells.dts; do
+	run_sh_test "$SRCDIR/dtc-jobs.sh" 4 -f -I dts -O dtb "$SRCDIR/$tree"
+    done
 
     # Check warning options
     run_sh_test "$SRCDIR/dtc-checkfails.sh" address_cells_is_cell interrupts_extended_is_cell -n size_cells_is_cell -- -Wno_size_cells_is_cell -I dts -O dtb "$SRCDIR/bad-ncells.dts"
@@ -990,6 +1160,14 @@ fdtoverlay_tests() {
     # test that the new property is installed
     run_fdtoverlay_test foobar "/test-node" "test-str-property" "-ts" ${basedtb} ${targetdtb} ${overlaydtb}
 
+    # test that an overlay resolved against the base applies the same
+    resolveddtb=overlay_overlay_manual_fixups.resolved.test.dtb
+    resolved_targetdtb=target_resolved.fdoverlay.test.dtb
+    run_wrap_test $FDTOVERLAY -r -i ${basedtb} -o ${resolveddtb} ${overlaydtb}
+    run_test check_path ${resolveddtb} exists "/__resolved__"
+    run_wrap_test $FDTOVERLAY -i ${basedtb} -o ${resolved_targetdtb} ${resolveddtb}
+    run_test dtbs_equal_ordered ${targetdtb} ${resolved_targetdtb}
+
     stacked_base="$SRCDIR/stacked_overlay_base.dts"
     stacked_basedtb=stacked_overlay_base.fdtoverlay.test.dtb
     stacked_bar="$SRCDIR/stacked_overlay_bar.dts"
@@ -1028,6 +1206,49 @@ fdtoverlay_tests() {
     run_dtc_test -@ -I dts -O dtb -o $stacked_addlabeldtb $stacked_addlabel
 
     run_fdtoverlay_test baz "/foonode/barnode/baznode" "baz-property" "-ts" ${stacked_base_nolabeldtb} ${stacked_addlabel_targetdtb} ${stacked_addlabeldtb} ${stacked_bardtb} ${stacked_bazdtb}
+
+    # test that an overlay generated from two trees turns one into the other
+    diff_old="$SRCDIR/diff_old.dts"
+    diff_new="$SRCDIR/diff_new.dts"
+    for sym in "" "-@"; do
+        pfx=diff${sym:+_symbols}
+        run_dtc_test $sym -I dts -O dtb -o ${pfx}_old.test.dtb $diff_old
+        run_dtc_test $sym -I dts -O dtb -o ${pfx}_new.test.dtb $diff_new
+
+        # from the sources
+        run_dtc_test $sym -D $diff_old -O dtb -o ${pfx}_overlay.test.dtb $diff_new
+        run_test check_path ${pfx}_overlay.test.dtb not-exists "/fragment@0/__overlay__/unchanged"
+        run_wrap_test $FDTOVERLAY -i ${pfx}_old.test.dtb -o ${pfx}_target.test.dtb ${pfx}_overlay.test.dtb
+        run_test dtbs_equal_unordered ${pfx}_target.test.dtb ${pfx}_new.test.dtb
+
+        # from the blobs
+        run_dtc_test $sym -D ${pfx}_old.test.dtb -I dtb -O dtb -o ${pfx}_blob_overlay.test.dtb ${pfx}_new.test.dtb
+        run_wrap_test $FDTOVERLAY -i ${pfx}_old.test.dtb -o ${pfx}_blob_target.test.dtb ${pfx}_blob_overlay.test.dtb
+        run_test dtbs_equal_unordered ${pfx}_blob_target.test.dtb ${pfx}_new.test.dtb
+    done
+
+    # removed nodes and properties can't be expressed in an overlay
+    run_wrap_error_test $DTC -D $diff_new -O dtb -o diff_removed.test.dtb $diff_old
+
+    # test that dtc merges overlays the same way fdtoverlay applies them
+    merged_refdtb=stacked_overlay_merged_ref.test.dtb
+    run_wrap_test $FDTOVERLAY -i ${stacked_basedtb} -o ${merged_refdtb} ${stacked_bardtb} ${stacked_bazdtb}
+    run_dtc_test -@ -O dtb -o stacked_overlay_merged_dts.test.dtb $stacked_base $stacked_bar $stacked_baz
+    run_test dtbs_equal_unordered ${merged_refdtb} stacked_overlay_merged_dts.test.dtb
+    run_dtc_test -O dtb -o stacked_overlay_merged_dtb.test.dtb ${stacked_basedtb} ${stacked_bardtb} ${stacked_bazdtb}
+    run_test dtbs_equal_unordered ${merged_refdtb} stacked_overlay_merged_dtb.test.dtb
+    run_dtc_test -@ -O dtb -o stacked_overlay_merged_mixed.test.dtb $stacked_base ${stacked_bardtb} $stacked_baz
+    run_test dtbs_equal_unordered ${merged_refdtb} stacked_overlay_merged_mixed.test.dtb
+
+    # local references of a compiled overlay
+    run_dtc_test -@ -I dts -O dtb -o overlay_merged_overlay.test.dtb "$SRCDIR/overlay_overlay.dts"
+    run_wrap_test $FDTOVERLAY -i ${basedtb} -o overlay_merged_ref.test.dtb overlay_merged_overlay.test.dtb
+    run_dtc_test -O dtb -o overlay_merged_dtb.test.dtb ${basedtb} overlay_merged_overlay.test.dtb
+    run_test dtbs_equal_unordered overlay_merged_ref.test.dtb overlay_merged_dtb.test.dtb
+    run_dtc_test -@ -O dtb -o overlay_merged_dts.test.dtb $base "$SRCDIR/overlay_overlay.dts"
+    run_fdtget_test "2 2" overlay_merged_dts.test.dtb /test-node test-several-phandle
+    run_fdtget_test 2 overlay_merged_dts.test.dtb /test-node/new-local-node phandle
+    run_wrap_error_test $DTC -O dtb -o overlay_merged_bad.test.dtb $base "$SRCDIR/overlay_bad_fixup_empty.dts"
 }
 
 pylibfdt_tests () {
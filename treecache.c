@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Cache of the trees parsed from included files.
+ *
+ * Board files mostly include the same SoC files, so most of the parsing
+ * in a run goes into trees which earlier runs have built already.  With
+ * --include-cache, the preprocessor hands the text of each file the
+ * input includes at the top level to treecache_unit() (see
+ * include_unit() in cpp.c).  That looks for the text in the cache
+ * directory, or else parses it on its own and stores what it built.
+ * Entries are named by a hash of the text and the dtc version, and
+ * hold the text itself to compare against, so macros, include paths
+ * and nested includes are all accounted for.
+ *
+ * With --batch, entries are also kept in memory for the inputs a
+ * process compiles later, with or without a cache directory.
+ *
+ * An entry holds the root nodes built by the text's "/ { ... };"
+ * statements, with their labels, markers and source positions.  Where
+ * the placeholder statement for the text is parsed, they are merged
+ * into the tree in turn, just as the statements themselves would have
+ * been.
+ */
+
+#include <sys/stat.h>
+
+#include "dtc.h"
+#include "srcpos.h"
+#include "version_gen.h"
+
+#define ENTRY_MAGIC	"dtcache\n"
+#define NO_STRING	0xffffffffU
+
+#define NODE_DELETED	0x1
+#define NODE_OMIT	0x2
+
+/* The root nodes built by one included file */
+struct unit {
+	struct node **roots;
+	int n;
+};
+
+static struct unit *units;
+static int nunits;
+static struct unit *recording;	/* while a unit is parsed */
+
+/* Entries kept in memory, for the later inputs of a batch */
+struct memo {
+	struct memo *next;
+	uint64_t hash;
+	struct data entry;
+};
+
+static struct memo *memos;
+
+/*
+ * Cache entries
+ */
+
+struct writer {
+	struct data d;
+	char **names;		/* of source files */
+	uint32_t nnames;
+};
+
+struct reader {
+	const char *p, *end;
+	bool bad;
+	char **names;
+	uint32_t nnames;
+};
+
+static void put_u32(struct writer *w, uint32_t v)
+{
+	w->d = data_append_cell(w->d, v);
+}
+
+static void put_string(struct writer *w, const char *s)
+{
+	if (!s) {
+		put_u32(w, NO_STRING);
+		return;
+	}
+	put_u32(w, strlen(s));
+	w->d = data_append_data(w->d, s, strlen(s));
+}
+
+static uint32_t name_number(struct writer *w, char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->nnames; i++)
+		if ((w->names[i] == name) || streq(w->names[i], name))
+			return i;
+
+	w->names = xrealloc(w->names, (w->nnames + 1) * sizeof(*w->names));
+	w->names[w->nnames] = name;
+	return w->nnames++;
+}
+
+static void put_labels(struct writer *w, struct label *labels)
+{
+	struct label *l;
+	uint32_t n = 0;
+
+	for_each_label_withdel(labels, l)
+		n++;
+	put_u32(w, n);
+	for_each_label_withdel(labels, l) {
+		put_u32(w, l->deleted);
+		put_string(w, l->label);
+	}
+}
+
+static void put_srcpos(struct writer *w, struct srcpos *pos)
+{
+	struct srcpos *p;
+	uint32_t n = 0;
+
+	for (p = pos; p; p = p->next)
+		n++;
+	put_u32(w, n);
+	for (p = pos; p; p = p->next) {
+		put_u32(w, name_number(w, p->file->name));
+		put_u32(w, p->first_line);
+		put_u32(w, p->first_column);
+		put_u32(w, p->last_line);
+		put_u32(w, p->last_column);
+	}
+}
+
+static void put_property(struct writer *w, struct property *prop)
+{
+	struct marker *m;
+	uint32_t n = 0;
+
+	put_u32(w, prop->deleted);
+	put_string(w, prop->name);
+	put_labels(w, prop->labels);
+	put_srcpos(w, prop->srcpos);
+
+	put_u32(w, prop->val.len);
+	w->d = data_append_data(w->d, prop->val.val, prop->val.len);
+	for (m = prop->val.markers; m; m = m->next)
+		n++;
+	put_u32(w, n);
+	for (m = prop->val.markers; m; m = m->next) {
+		put_u32(w, m->type);
+		put_u32(w, m->offset);
+		put_string(w, m->ref);
+	}
+}
+
+static void put_node(struct writer *w, struct node *node, bool root)
+{
+	struct property *prop;
+	struct node *child;
+	uint32_t n;
+
+	put_u32(w, (node->deleted ? NODE_DELETED : 0)
+		| (node->omit_if_unused ? NODE_OMIT : 0));
+	/* Roots are named when they are merged into a tree */
+	if (!root)
+		put_string(w, node->name);
+	put_labels(w, node->labels);
+	put_srcpos(w, node->srcpos);
+
+	n = 0;
+	for_each_property_withdel(node, prop)
+		n++;
+	put_u32(w, n);
+	for_each_property_withdel(node, prop)
+		put_property(w, prop);
+
+	n = 0;
+	for_each_child_withdel(node, child)
+		n++;
+	put_u32(w, n);
+	for_each_child_withdel(node, child)
+		put_node(w, child, false);
+}
+
+static struct data unit_entry(const char *text, size_t len,
+			      struct unit *unit)
+{
+	struct writer nodes = { empty_data, NULL, 0 };
+	struct writer w = { empty_data, NULL, 0 };
+	uint32_t i;
+
+	for (i = 0; i < (uint32_t)unit->n; i++)
+		put_node(&nodes, unit->roots[i], true);
+
+	w.d = data_append_data(w.d, ENTRY_MAGIC, strlen(ENTRY_MAGIC));
+	put_string(&w, DTC_VERSION);
+	put_u32(&w, len);
+	w.d = data_append_data(w.d, text, len);
+	put_u32(&w, nodes.nnames);
+	for (i = 0; i < nodes.nnames; i++)
+		put_string(&w, nodes.names[i]);
+	put_u32(&w, unit->n);
+	w.d = data_append_data(w.d, nodes.d.val, nodes.d.len);
+
+	free(nodes.names);
+	data_free(nodes.d);
+	return w.d;
+}
+
+static const char *get_bytes(struct reader *r, uint32_t len)
+{
+	const char *p = r->p;
+
+	if (r->bad || ((size_t)(r->end - r->p) < len)) {
+		r->bad = true;
+		return NULL;
+	}
+	r->p += len;
+	return p;
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+	const char *p = get_bytes(r, sizeof(fdt32_t));
+	fdt32_t v;
+
+	if (!p)
+		return 0;
+	memcpy(&v, p, sizeof(v));
+	return fdt32_to_cpu(v);
+}
+
+/* A count of things taking at least size bytes each */
+static uint32_t get_count(struct reader *r, size_t size)
+{
+	uint32_t n = get_u32(r);
+
+	if ((size_t)(r->end - r->p) / size < n) {
+		r->bad = true;
+		return 0;
+	}
+	return n;
+}
+
+static char *get_string(struct reader *r)
+{
+	uint32_t len = get_u32(r);
+	const char *p;
+
+	if (len == NO_STRING)
+		return NULL;
+	p = get_bytes(r, len);
+	return p ? xstrndup(p, len) : NULL;
+}
+
+static struct label *get_labels(struct reader *r)
+{
+	uint32_t i, n = get_count(r, 8);
+	struct label *labels = NULL;
+	bool *deleted = xmalloc(n * sizeof(*deleted) + 1);
+	char **names = xmalloc(n * sizeof(*names) + 1);
+
+	for (i = 0; i < n; i++) {
+		deleted[i] = get_u32(r);
+		names[i] = get_string(r);
+		if (!names[i])
+			r->bad = true;
+	}
+
+	/* add_label() puts each in front */
+	for (i = n; i-- > 0; ) {
+		if (r->bad) {
+			free(names[i]);
+			continue;
+		}
+		add_label(&labels, names[i]);
+		labels->deleted = deleted[i];
+	}
+
+	free(deleted);
+	free(names);
+	return r->bad ? NULL : labels;
+}
+
+static struct srcpos *get_srcpos(struct reader *r)
+{
+	uint32_t i, n = get_count(r, 20);
+	struct srcpos *pos = NULL;
+
+	for (i = 0; i < n; i++) {
+		struct srcfile_state file = { 0 };
+		struct srcpos p = { 0 };
+		uint32_t name = get_u32(r);
+
+		if (name >= r->nnames) {
+			r->bad = true;
+			return NULL;
+		}
+		file.name = r->names[name];
+		p.first_line = get_u32(r);
+		p.first_column = get_u32(r);
+		p.last_line = get_u32(r);
+		p.last_column = get_u32(r);
+		p.file = &file;
+		pos = srcpos_extend(pos, srcpos_copy(&p));
+	}
+
+	return pos;
+}
+
+static struct property *load_property(struct reader *r)
+{
+	struct property *prop;
+	struct marker *m, **tail;
+	struct data d = empty_data;
+	bool deleted = get_u32(r);
+	char *name = get_string(r);
+	struct label *labels = get_labels(r);
+	struct srcpos *pos = get_srcpos(r);
+	uint32_t len = get_u32(r);
+	const char *val = get_bytes(r, len);
+	uint32_t i, n = get_count(r, 12);
+
+	if (r->bad || !name)
+		goto bad;
+
+	if (len)
+		d = data_copy_mem(val, len);
+	tail = &d.markers;
+	for (i = 0; i < n; i++) {
+		m = arena_alloc(sizeof(*m));
+		m->type = get_u32(r);
+		m->offset = get_u32(r);
+		m->ref = get_string(r);
+		m->next = NULL;
+		if ((m->type > TYPE_STRING) || (m->offset > len))
+			r->bad = true;
+		*tail = m;
+		tail = &m->next;
+	}
+	if (r->bad)
+		goto bad;
+
+	if (deleted) {
+		prop = build_property_delete(name);
+		data_free(d);
+	} else {
+		prop = build_property(name, d, NULL);
+	}
+	prop->labels = labels;
+	prop->srcpos = pos;
+	return prop;
+
+bad:
+	r->bad = true;
+	prop = build_property(name, d, NULL);
+	prop->labels = labels;
+	free_property(prop);
+	return NULL;
+}
+
+static struct node *load_node(struct reader *r, bool root)
+{
+	struct property *props = NULL, *prop;
+	struct node *children = NULL, **tail = &children, *node;
+	uint32_t flags = get_u32(r);
+	char *name = root ? NULL : get_string(r);
+	struct label *labels = get_labels(r);
+	struct srcpos *pos = get_srcpos(r);
+	uint32_t i, n;
+
+	if (!root && !name)
+		r->bad = true;
+
+	n = get_count(r, 4);
+	for (i = 0; !r->bad && (i < n); i++) {
+		prop = load_property(r);
+		if (prop)
+			props = chain_property(prop, props);
+	}
+
+	n = get_count(r, 4);
+	for (i = 0; !r->bad && (i < n); i++) {
+		node = load_node(r, false);
+		if (node) {
+			*tail = node;
+			tail = &node->next_sibling;
+		}
+	}
+
+	node = build_node(props, children, NULL);
+	node->name = name;
+	node->labels = labels;
+	node->srcpos = pos;
+
+	if (r->bad) {
+		free_node(node);
+		return NULL;
+	}
+
+	if (flags & NODE_DELETED)
+		node->deleted = 1;
+	if (flags & NODE_OMIT)
+		omit_node_if_unused(node);
+
+	return node;
+}
+
+static void free_unit(struct unit *unit)
+{
+	int i;
+
+	for (i = 0; i < unit->n; i++)
+		if (unit->roots[i])
+			free_node(unit->roots[i]);
+	free(unit->roots);
+	unit->roots = NULL;
+	unit->n = 0;
+}
+
+static bool load_unit(struct data entry, const char *text, size_t len,
+		      struct unit *unit)
+{
+	struct reader r = { entry.val, entry.val + entry.len, false, NULL, 0 };
+	const char *p;
+	char *version;
+	uint32_t i, n;
+
+	p = get_bytes(&r, strlen(ENTRY_MAGIC));
+	if (!p || memcmp(p, ENTRY_MAGIC, strlen(ENTRY_MAGIC)))
+		return false;
+	version = get_string(&r);
+	if (!version || !streq(version, DTC_VERSION)) {
+		free(version);
+		return false;
+	}
+	free(version);
+	n = get_u32(&r);
+	p = get_bytes(&r, n);
+	if (!p || (n != len) || memcmp(p, text, len))
+		return false;
+
+	/* Source positions point at their file names in the arena */
+	r.nnames = get_count(&r, 4);
+	r.names = xmalloc(r.nnames * sizeof(*r.names) + 1);
+	for (i = 0; i < r.nnames; i++) {
+		char *name = get_string(&r);
+
+		r.names[i] = name ? arena_strdup(name) : NULL;
+		if (!name)
+			r.bad = true;
+		free(name);
+	}
+
+	n = get_count(&r, 4);
+	unit->roots = xmalloc(n * sizeof(*unit->roots) + 1);
+	for (unit->n = 0; !r.bad && ((uint32_t)unit->n < n); unit->n++)
+		unit->roots[unit->n] = load_node(&r, true);
+
+	if (r.bad || (r.p != r.end) || !n) {
+		free_unit(unit);
+		r.bad = true;
+	}
+	free(r.names);
+
+	return !r.bad;
+}
+
+static uint64_t entry_hash(const char *text, size_t len)
+{
+	const char *version = DTC_VERSION;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < strlen(version) + 1; i++)
+		h = (h ^ (unsigned char)version[i]) * 1099511628211ULL;
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)text[i]) * 1099511628211ULL;
+
+	return h;
+}
+
+static void write_entry(const char *path, struct data entry)
+{
+	static bool warned;
+	char *tmp;
+	FILE *f;
+	bool ok;
+
+	/* Whole entries only, even with other dtc runs at it */
+	xasprintf(&tmp, "%s.%ld.tmp", path, (long)getpid());
+	f = fopen(tmp, "wb");
+	ok = f && (fwrite(entry.val, 1, entry.len, f) == entry.len);
+	if (f && fclose(f))
+		ok = false;
+	if (ok && rename(tmp, path))
+		ok = false;
+
+	if (!ok) {
+		if (!warned && (quiet < 1))
+			fprintf(stderr, "Warning: Couldn't write include cache entry \"%s\": %s\n",
+				path, strerror(errno));
+		warned = true;
+		remove(tmp);
+	}
+	free(tmp);
+}
+
+/*
+ * Parse a unit on its own, recording the root nodes its statements
+ * build rather than merging them.  Returns false if parsing it gave
+ * warnings, which a run loading it from the cache would not repeat.
+ */
+static bool parse_unit(const char *text, size_t len, struct unit *unit)
+{
+	static const char header[] = "/dts-v1/;\n";
+	size_t hlen = strlen(header);
+	char *buf = xmalloc(hlen + len);
+	bool clean;
+	int i;
+
+	memcpy(buf, header, hlen);
+	memcpy(buf + hlen, text, len);
+
+	recording = unit;
+	clean = dt_from_text(buf, hlen + len, TREECACHE_UNIT);
+	recording = NULL;
+	free(buf);
+
+	/* The parser named the first root for a tree of its own */
+	for (i = 0; i < unit->n; i++) {
+		free(unit->roots[i]->name);
+		unit->roots[i]->name = NULL;
+	}
+
+	return clean;
+}
+
+static struct data read_entry(const char *path)
+{
+	struct data entry = empty_data;
+	FILE *f = fopen(path, "rb");
+
+	if (f) {
+		entry = data_copy_file(f, -1);
+		fclose(f);
+	}
+	return entry;
+}
+
+int treecache_unit(const char *text, size_t len)
+{
+	static bool made_dir;
+	struct unit *unit, parsed = { NULL, 0 };
+	struct data entry = empty_data;
+	struct memo *m;
+	uint64_t hash = entry_hash(text, len);
+	char *path = NULL;
+
+	units = xrealloc(units, (nunits + 1) * sizeof(*units));
+	unit = &units[nunits];
+	memset(unit, 0, sizeof(*unit));
+
+	for (m = memos; m; m = m->next)
+		if ((m->hash == hash) && load_unit(m->entry, text, len, unit))
+			return nunits++;
+
+	if (include_cache) {
+		if (!made_dir) {
+			/* Anything wrong with it shows when entries are written */
+			mkdir(include_cache, 0777);
+			made_dir = true;
+		}
+		xasprintf(&path, "%s/%016" PRIx64 ".dtcache", include_cache,
+			  hash);
+		entry = read_entry(path);
+	}
+
+	if (!load_unit(entry, text, len, unit)) {
+		data_free(entry);
+		entry = empty_data;
+
+		if (parse_unit(text, len, &parsed)) {
+			entry = unit_entry(text, len, &parsed);
+			if (path)
+				write_entry(path, entry);
+		}
+		/*
+		 * Use what was stored, so a run filling the cache
+		 * builds its tree just as the runs reading it do.
+		 */
+		if (!load_unit(entry, text, len, unit))
+			*unit = parsed;
+		else
+			free_unit(&parsed);
+	}
+
+	if (keep_includes && entry.len) {
+		m = xmalloc(sizeof(*m));
+		m->hash = hash;
+		m->entry = entry;
+		m->next = memos;
+		memos = m;
+	} else {
+		data_free(entry);
+	}
+	free(path);
+	return nunits++;
+}
+
+/* Done with the units of a run, so the next input numbers its own */
+void treecache_reset(void)
+{
+	int i;
+
+	for (i = 0; i < nunits; i++)
+		free_unit(&units[i]);
+	free(units);
+	units = NULL;
+	nunits = 0;
+}
+
+struct node *treecache_merge(struct node *dt, struct node *node)
+{
+	struct unit *unit;
+	int i;
+
+	if (recording) {
+		recording->roots = xrealloc(recording->roots,
+					    (recording->n + 1)
+					    * sizeof(*recording->roots));
+		recording->roots[recording->n++] = node;
+		return dt ? dt : node;
+	}
+
+	if (node->srcpos && streq(node->srcpos->file->name, TREECACHE_UNIT)) {
+		assert((node->srcpos->first_line >= 1)
+		       && (node->srcpos->first_line <= nunits));
+		unit = &units[node->srcpos->first_line - 1];
+
+		for (i = 0; i < unit->n; i++)
+			dt = dt ? merge_nodes(dt, unit->roots[i])
+				: unit->roots[i];
+		free(unit->roots);
+		unit->roots = NULL;
+		unit->n = 0;
+		return dt;
+	}
+
+	return dt ? merge_nodes(dt, node) : node;
+}
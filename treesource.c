@@ -7,19 +7,23 @@
 #include "srcpos.h"
 
 extern FILE *yyin;
+extern void yyrestart(FILE *);
 extern int yyparse(void);
 extern YYLTYPE yylloc;
 
 struct dt_info *parser_output;
 bool treesource_error;
+bool treesource_warning;
 
-struct dt_info *dt_from_source(const char *fname)
+static struct dt_info *parse_input(void)
 {
 	parser_output = NULL;
 	treesource_error = false;
+	treesource_warning = false;
 
-	srcfile_push(fname);
 	yyin = current_srcfile->f;
+	/* The scanner may have hit the end of an earlier input */
+	yyrestart(yyin);
 	yylloc.file = current_srcfile;
 
 	if (yyparse() != 0)
@@ -31,6 +35,53 @@ struct dt_info *dt_from_source(const char *fname)
 	return parser_output;
 }
 
+struct dt_info *dt_from_source(const char *fname)
+{
+	struct dt_info *dti;
+	char *text = NULL;
+
+	if (preprocess) {
+		char *fullname;
+		size_t len;
+		FILE *f;
+
+		/*
+		 * Preprocess before pushing the file: the include cache
+		 * parses parts of the text on their own as it goes.
+		 */
+		f = srcfile_relative_open(fname, &fullname);
+		text = cpp_preprocess(f, fullname, &len);
+		fclose(f);
+
+		/* The lexer reads the preprocessed text in place of the file */
+		f = fmemopen(text, len, "r");
+		if (!f)
+			die("Couldn't open preprocessed \"%s\": %s\n",
+			    fullname, strerror(errno));
+		srcfile_push_file(f, fullname);
+	} else {
+		srcfile_push(fname);
+	}
+
+	dti = parse_input();
+
+	free(text);
+	return dti;
+}
+
+bool dt_from_text(char *text, size_t len, const char *name)
+{
+	FILE *f = fmemopen(text, len, "r");
+
+	if (!f)
+		die("Couldn't open preprocessed \"%s\": %s\n", name,
+		    strerror(errno));
+	srcfile_push_file(f, xstrdup(name));
+	parse_input();
+
+	return !treesource_warning;
+}
+
 static void write_prefix(FILE *f, int level)
 {
 	int i;
@@ -23,6 +23,77 @@
 #include "util.h"
 #include "version_gen.h"
 
+#define ARENA_BLOCK_UNITS	4096
+
+union arena_unit {
+	void *p;
+	long long ll;
+	double d;
+};
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size, used;		/* in units */
+	union arena_unit data[];
+};
+
+static struct arena_block *arena;
+static size_t arena_allocs, arena_bytes;
+
+void *arena_alloc(size_t len)
+{
+	size_t n = (len + sizeof(union arena_unit) - 1)
+		/ sizeof(union arena_unit);
+	struct arena_block *b = arena;
+
+	if (!b || ((b->size - b->used) < n)) {
+		size_t size = (n > ARENA_BLOCK_UNITS) ? n : ARENA_BLOCK_UNITS;
+
+		b = xmalloc(sizeof(*b) + size * sizeof(b->data[0]));
+		b->size = size;
+		b->used = 0;
+
+		/* Keep filling the current block after an oversized one */
+		if (arena && (n > ARENA_BLOCK_UNITS)) {
+			b->next = arena->next;
+			arena->next = b;
+		} else {
+			b->next = arena;
+			arena = b;
+		}
+	}
+
+	arena_allocs++;
+	arena_bytes += len;
+
+	b->used += n;
+	return &b->data[b->used - n];
+}
+
+char *arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(arena_alloc(len), s, len);
+}
+
+void arena_stats(size_t *allocs, size_t *bytes)
+{
+	*allocs = arena_allocs;
+	*bytes = arena_bytes;
+}
+
+void arena_free_all(void)
+{
+	struct arena_block *b;
+
+	while (arena) {
+		b = arena;
+		arena = b->next;
+		free(b);
+	}
+}
+
 char *xstrdup(const char *s)
 {
 	int len = strlen(s) + 1;
@@ -44,6 +115,17 @@ char *xstrndup(const char *s, size_t n)
 	return d;
 }
 
+/* 32-bit FNV-1a */
+unsigned int str_hash(const char *s, size_t len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h;
+}
+
 int xavsprintf_append(char **strp, const char *fmt, va_list ap)
 {
 	int n, size = 0;	/* start with 128 bytes */
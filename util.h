@@ -60,9 +60,26 @@ static inline void *xrealloc(void *p, size_t len)
 	return new;
 }
 
+/*
+ * Session arena: the objects making up a tree (nodes, properties, labels,
+ * markers, source positions and the source files they name) are bump
+ * allocated from large blocks by arena_alloc(), never freed one by one,
+ * and all released together by arena_free_all() once the tree is done
+ * with.  Names and property values are the tree's own, and go first with
+ * free_dt_info().
+ */
+extern void *arena_alloc(size_t len);
+extern char *arena_strdup(const char *s);
+extern void arena_free_all(void);
+/* Objects and bytes handed out by arena_alloc() so far */
+extern void arena_stats(size_t *allocs, size_t *bytes);
+
 extern char *xstrdup(const char *s);
 extern char *xstrndup(const char *s, size_t len);
 
+/* Hash of the len bytes at s, for the hash tables of names and labels */
+extern unsigned int str_hash(const char *s, size_t len);
+
 extern int PRINTF(2, 3) xasprintf(char **strp, const char *fmt, ...);
 extern int PRINTF(2, 3) xasprintf_append(char **strp, const char *fmt, ...);
 extern int xavsprintf_append(char **strp, const char *fmt, va_list ap);